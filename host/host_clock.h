@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include "brainfuck_clock.h"
+
+/// clock_control of a host, only the timer works, the clock is whatever the OS runs at
+struct host_clock : clock_control {
+    uint32_t get_khz() const override {
+        return 0;
+    }
+
+    bool can_set_khz(uint32_t) const override {
+        return false;
+    }
+
+    bool set_khz(uint32_t) override {
+        return false;
+    }
+
+    void set_voltage(core_voltage) override {
+    }
+
+    uint64_t now_us() const override {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
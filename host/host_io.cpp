@@ -0,0 +1,124 @@
+#include "host_io.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma mark - mapped file
+
+mapped_file::~mapped_file() {
+    if (size) {
+        munmap(const_cast<char *>(data), size);
+    }
+}
+
+bool mapped_file::open(const char * path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool mapped = map(fd);
+    int error = errno;
+    // the mapping stays valid without the descriptor
+    close(fd);
+    errno = error;
+    return mapped;
+}
+
+bool mapped_file::map(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = ENODEV;
+        return false;
+    }
+
+    if (st.st_size > 0) {
+        void * map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        // programs and inputs are read front to back exactly once
+        madvise(map, size_t(st.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const char *>(map);
+        size = size_t(st.st_size);
+    }
+    return true;
+}
+
+bool map_or_read(int fd, mapped_file & file, std::vector<char> & fallback, const char *& data, size_t & len) {
+    if (file.map(fd)) {
+        data = file.data;
+        len = file.size;
+        return true;
+    }
+    if (errno != ENODEV) {
+        return false;
+    }
+
+    size_t read_len = 0;
+    fallback.resize(1 << 16);
+    for (;;) {
+        if (read_len == fallback.size()) {
+            fallback.resize(fallback.size() * 2);
+        }
+        ssize_t n = read(fd, fallback.data() + read_len, fallback.size() - read_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        read_len += size_t(n);
+    }
+    fallback.resize(read_len);
+    data = fallback.data();
+    len = read_len;
+    return true;
+}
+
+bool load_file(const char * path, mapped_file & file, std::vector<char> & fallback, const char *& data, size_t & len) {
+    int fd = ::open(path, O_RDONLY);
+    bool loaded = fd >= 0 && map_or_read(fd, file, fallback, data, len);
+    if (!loaded) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return loaded;
+}
+
+#pragma mark - buffered io
+
+buffered_io::buffered_io(const char * input, size_t input_len, int output_fd, int eof)
+    : input(input), input_len(input_len), output_fd(output_fd), eof(eof), buffer(PICO_BF_HOST_OUTPUT_BUFFER) {
+}
+
+buffered_io::~buffered_io() {
+    flush();
+}
+
+bool buffered_io::flush() {
+    const char * pending = buffer.data();
+    size_t left = buffer_len;
+    while (left) {
+        ssize_t n = write(output_fd, pending, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // nowhere to write to, drop the output rather than the run
+            failed = true;
+            buffer_len = 0;
+            return false;
+        }
+        pending += n;
+        left -= size_t(n);
+        flushed += size_t(n);
+    }
+    buffer_len = 0;
+    return true;
+}
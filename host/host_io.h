@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "brainfuck_io.h"
+
+/// size of the output buffer of buffered_io, flushed with a single write(2) when full
+#define PICO_BF_HOST_OUTPUT_BUFFER (1 << 20)
+
+#pragma mark - mapped file
+
+/// a whole file mapped read-only into memory
+struct mapped_file {
+    mapped_file() = default;
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+    ~mapped_file();
+
+    /**
+     map a file, an empty file maps to an empty range
+
+     @param path path of the file
+     @return whether the file could be mapped, errno is left set otherwise
+    */
+    bool open(const char * path);
+
+    /**
+     map an open regular file, the descriptor stays open
+
+     @param fd file descriptor
+     @return whether the file could be mapped, fails with ENODEV for pipes and terminals
+    */
+    bool map(int fd);
+
+    /// first byte of the file
+    const char * data = nullptr;
+    /// length of the file
+    size_t size = 0;
+};
+
+/**
+ map a file, or read it into `fallback` when it cannot be mapped, e.g. a pipe
+
+ @param fd       file descriptor
+ @param file     mapping of the file
+ @param fallback buffer used when mapping is not possible
+ @param data     first byte of the contents
+ @param len      length of the contents
+ @return whether the contents could be read
+*/
+bool map_or_read(int fd, mapped_file & file, std::vector<char> & fallback, const char *& data, size_t & len);
+
+/**
+ map a file given on the command line, or read it if it is not a regular file
+
+ @param path     path of the file
+ @param file     mapping of the file
+ @param fallback buffer used when mapping is not possible
+ @param data     first byte of the contents
+ @param len      length of the contents
+ @return whether the contents could be read, an error is printed otherwise
+*/
+bool load_file(const char * path, mapped_file & file, std::vector<char> & fallback, const char *& data, size_t & len);
+
+#pragma mark - buffered io
+
+/// brainfuck_io reading from memory and writing to a file descriptor through a large buffer
+struct buffered_io : brainfuck_io {
+    /**
+     @param input     program input, read once from start to end
+     @param input_len length of the input
+     @param output_fd file descriptor output is written to
+     @param eof       value `,` reads once the input is exhausted
+    */
+    buffered_io(const char * input, size_t input_len, int output_fd, int eof);
+    ~buffered_io() override;
+
+    void put(char c) override {
+        if (buffer_len == buffer.size()) {
+            flush();
+        }
+        buffer[buffer_len++] = c;
+    }
+
+    int get() override {
+        return input_pos < input_len ? static_cast<unsigned char>(input[input_pos++]) : eof;
+    }
+
+    /**
+     write out everything buffered so far
+
+     @return whether the write succeeded, the buffer is emptied either way
+    */
+    bool flush();
+
+    /// number of bytes written by the program, buffered or not
+    size_t written() const {
+        return flushed + buffer_len;
+    }
+
+    const char * input;
+    size_t input_len;
+    size_t input_pos = 0;
+    int output_fd;
+    int eof;
+
+    std::vector<char> buffer;
+    size_t buffer_len = 0;
+    size_t flushed = 0;
+    /// a write failed, later output is dropped
+    bool failed = false;
+};
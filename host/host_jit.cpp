@@ -0,0 +1,349 @@
+#include "host_jit.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+
+/// IR ops, loop bodies included, a function holds before the top-level block is cut,
+/// the optimiser takes superlinear time on long functions
+#define PICO_BF_HOST_JIT_SEGMENT_OPS 1024
+/// prefix of the function names, the segment number follows
+#define PICO_BF_HOST_JIT_SEGMENT "pico_bf_jit_segment"
+
+/// machine code of a segment of a program: cells of the tape, the pointer as an offset into them,
+/// updated when it returns, and the io; returns the ops run
+using jit_segment = uint64_t (*)(char * cells, int32_t * offset, brainfuck_io * io);
+
+struct jit_program {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    /// segments of the top-level block, run one after the other
+    std::vector<jit_segment> segments;
+    /// tape the code addresses, bounded or ring
+    tape_mode mode = tape_mode::bounded;
+};
+
+#pragma mark - io callbacks
+
+// `.` and `,` are the only calls out of the machine code
+
+extern "C" void pico_bf_jit_put(brainfuck_io * io, int32_t c) {
+    io->put(char(c));
+}
+
+extern "C" int32_t pico_bf_jit_get(brainfuck_io * io) {
+    return io->get();
+}
+
+#pragma mark - lowering
+
+/// lowers brainfuck blocks into segment functions
+struct jit_lowering {
+    /**
+     @param module where the functions go
+     @param mode   tape the code addresses
+     @param mask   ring_mask of a ring tape
+    */
+    jit_lowering(llvm::Module & module, tape_mode mode, uint32_t mask)
+        : module(module), context(module.getContext()), builder(context), mode(mode), mask(mask) {
+        llvm::Type * io_type = builder.getInt8PtrTy();
+        put = module.getOrInsertFunction("pico_bf_jit_put", builder.getVoidTy(), io_type, builder.getInt32Ty());
+        get = module.getOrInsertFunction("pico_bf_jit_get", builder.getInt32Ty(), io_type);
+    }
+
+    /**
+     start the function of the next segment
+
+     @param name its name
+    */
+    void begin_segment(const std::string & name) {
+        llvm::Type * cell_type = builder.getInt8Ty();
+        llvm::Type * cells_type = cell_type->getPointerTo();
+        auto * segment_type = llvm::FunctionType::get(builder.getInt64Ty(),
+                                                      {cells_type, builder.getInt32Ty()->getPointerTo(), builder.getInt8PtrTy()}, false);
+        function = llvm::Function::Create(segment_type, llvm::Function::ExternalLinkage, name, module);
+        // the callbacks never see the tape, so cells stay in registers across `.` and `,`
+        function->addParamAttr(0, llvm::Attribute::NoAlias);
+        function->addParamAttr(1, llvm::Attribute::NoAlias);
+
+        cells = function->getArg(0);
+        offset = function->getArg(1);
+        io = function->getArg(2);
+        builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", function));
+        ops = builder.CreateAlloca(builder.getInt64Ty(), nullptr, "ops");
+        builder.CreateStore(builder.getInt64(0), ops);
+        llvm::Value * start = builder.CreateLoad(builder.getInt32Ty(), offset);
+        if (mode == tape_mode::ring) {
+            pointer = builder.CreateAlloca(builder.getInt32Ty(), nullptr, "index");
+            builder.CreateStore(start, pointer);
+        } else {
+            pointer = builder.CreateAlloca(cells_type, nullptr, "pointer");
+            builder.CreateStore(builder.CreateGEP(cell_type, cells, builder.CreateSExt(start, builder.getInt64Ty())), pointer);
+        }
+    }
+
+    /**
+     address of the current cell
+
+     @return pointer to the cell
+    */
+    llvm::Value * cell() {
+        if (mode == tape_mode::ring) {
+            llvm::Value * index = builder.CreateLoad(builder.getInt32Ty(), pointer);
+            return builder.CreateGEP(builder.getInt8Ty(), cells, builder.CreateZExt(index, builder.getInt64Ty()));
+        }
+        return builder.CreateLoad(builder.getInt8PtrTy(), pointer);
+    }
+
+    /**
+     whether the current cell is not 0, the test of a loop
+
+     @return i1
+    */
+    llvm::Value * cell_set() {
+        return builder.CreateICmpNE(builder.CreateLoad(builder.getInt8Ty(), cell()), builder.getInt8(0));
+    }
+
+    /**
+     count ops run
+
+     @param cost run_cost of a basic block
+    */
+    void charge(uint32_t cost) {
+        llvm::Value * count = builder.CreateLoad(builder.getInt64Ty(), ops);
+        builder.CreateStore(builder.CreateAdd(count, builder.getInt64(cost)), ops);
+    }
+
+    /**
+     lower ops of a block, loop bodies are lowered in place at every loop sharing them
+
+     the block is charged with its first op, there is no fuel to run out of between
+     segments, so a cut never changes the count
+
+     @param block compiled block
+     @param from  first op
+     @param to    end of the ops
+    */
+    void lower_block(const brainfuck_block & block, size_t from, size_t to) {
+        if (from == 0) {
+            charge(block.run_cost[0]);
+        }
+        for (size_t index = from; index < to; index++) {
+            std::visit(brainfuck_vm {
+                [&](const add_ir & add) {
+                    llvm::Value * at = cell();
+                    llvm::Value * value = builder.CreateLoad(builder.getInt8Ty(), at);
+                    builder.CreateStore(builder.CreateAdd(value, builder.getInt8(uint8_t(add.delta))), at);
+                },
+                [&](const move_ir & move) {
+                    if (mode == tape_mode::ring) {
+                        llvm::Value * index = builder.CreateLoad(builder.getInt32Ty(), pointer);
+                        index = builder.CreateAdd(index, builder.getInt32(uint32_t(move.delta)));
+                        builder.CreateStore(builder.CreateAnd(index, builder.getInt32(mask)), pointer);
+                    } else {
+                        llvm::Value * at = builder.CreateLoad(builder.getInt8PtrTy(), pointer);
+                        builder.CreateStore(builder.CreateGEP(builder.getInt8Ty(), at, builder.getInt64(move.delta)), pointer);
+                    }
+                },
+                [&](const print_ir &) {
+                    llvm::Value * value = builder.CreateLoad(builder.getInt8Ty(), cell());
+                    builder.CreateCall(put, {io, builder.CreateSExt(value, builder.getInt32Ty())});
+                },
+                [&](const read_ir &) {
+                    llvm::Value * value = builder.CreateCall(get, {io});
+                    builder.CreateStore(builder.CreateTrunc(value, builder.getInt8Ty()), cell());
+                },
+                [&](const loop_ir & loop) {
+                    // the test before the loop, then the body as a do-while ending in the back-edge test
+                    auto * body = llvm::BasicBlock::Create(context, "body", function);
+                    auto * after = llvm::BasicBlock::Create(context, "after", function);
+                    builder.CreateCondBr(cell_set(), body, after);
+                    builder.SetInsertPoint(body);
+                    lower_block(*loop.body, 0, loop.body->ops.size());
+                    builder.CreateCondBr(cell_set(), body, after);
+                    builder.SetInsertPoint(after);
+                    charge(block.run_cost[index + 1]);
+                }
+            }, block.ops[index]);
+        }
+    }
+
+    /// end the function of the segment: hand the pointer back and return the ops run
+    void finish_segment() {
+        llvm::Value * end = nullptr;
+        if (mode == tape_mode::ring) {
+            end = builder.CreateLoad(builder.getInt32Ty(), pointer);
+        } else {
+            llvm::Value * at = builder.CreateLoad(builder.getInt8PtrTy(), pointer);
+            end = builder.CreateTrunc(builder.CreatePtrDiff(builder.getInt8Ty(), at, cells), builder.getInt32Ty());
+        }
+        builder.CreateStore(end, offset);
+        builder.CreateRet(builder.CreateLoad(builder.getInt64Ty(), ops));
+    }
+
+    llvm::Module & module;
+    llvm::LLVMContext & context;
+    llvm::IRBuilder<> builder;
+    tape_mode mode;
+    uint32_t mask;
+    llvm::Function * function = nullptr;
+    llvm::FunctionCallee put;
+    llvm::FunctionCallee get;
+    llvm::Value * cells = nullptr;
+    llvm::Value * offset = nullptr;
+    llvm::Value * io = nullptr;
+    /// locals promoted to registers by the optimiser: ops run, and the cell pointer or ring index
+    llvm::Value * ops = nullptr;
+    llvm::Value * pointer = nullptr;
+};
+
+/**
+ IR ops a block lowers to, counting a loop body at every loop
+
+ @param block compiled block
+ @param sizes sizes of the bodies found so far, they are shared
+ @return number of ops
+*/
+static size_t lowered_ops(const brainfuck_block & block, std::unordered_map<const brainfuck_block *, size_t> & sizes) {
+    auto found = sizes.find(&block);
+    if (found != sizes.end()) {
+        return found->second;
+    }
+    size_t ops = block.ops.size();
+    for (const brainfuck_ir & op : block.ops) {
+        if (const loop_ir * loop = std::get_if<loop_ir>(&op)) {
+            ops += lowered_ops(*loop->body, sizes);
+        }
+    }
+    sizes[&block] = ops;
+    return ops;
+}
+
+/**
+ run the LLVM optimisation pipeline on a module
+
+ @param module    the module
+ @param machine   target it is compiled for
+ @param opt_level 2 or 3
+*/
+static void optimise(llvm::Module & module, llvm::TargetMachine & machine, unsigned opt_level) {
+    llvm::LoopAnalysisManager loops;
+    llvm::FunctionAnalysisManager functions;
+    llvm::CGSCCAnalysisManager cgscc;
+    llvm::ModuleAnalysisManager modules;
+    llvm::PassBuilder passes(&machine);
+    passes.registerModuleAnalyses(modules);
+    passes.registerCGSCCAnalyses(cgscc);
+    passes.registerFunctionAnalyses(functions);
+    passes.registerLoopAnalyses(loops);
+    passes.crossRegisterProxies(loops, functions, cgscc, modules);
+    llvm::ModulePassManager pipeline = passes.buildPerModuleDefaultPipeline(
+        opt_level >= 3 ? llvm::OptimizationLevel::O3 : llvm::OptimizationLevel::O2);
+    pipeline.run(module, modules);
+}
+
+#pragma mark - LLVM jit
+
+std::shared_ptr<const jit_program> jit_compile(const brainfuck_program & program, const brainfuck_vm_status & status,
+                                              unsigned opt_level, std::string & error) {
+    if (status.mode == tape_mode::infinite) {
+        error = "an infinite tape has no flat cells to compile against";
+        return nullptr;
+    }
+    static std::once_flag initialised;
+    std::call_once(initialised, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    auto target = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!target) {
+        error = llvm::toString(target.takeError());
+        return nullptr;
+    }
+    target->setCodeGenOptLevel(opt_level >= 3 ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::Default);
+    auto machine = target->createTargetMachine();
+    if (!machine) {
+        error = llvm::toString(machine.takeError());
+        return nullptr;
+    }
+    auto jit = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*target)).create();
+    if (!jit) {
+        error = llvm::toString(jit.takeError());
+        return nullptr;
+    }
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = std::make_unique<llvm::Module>("pico_bf_jit", *context);
+    module->setDataLayout((*jit)->getDataLayout());
+    module->setTargetTriple((*jit)->getTargetTriple().str());
+    // the top-level block is cut between ops into segments of about the same size,
+    // a loop is never cut so a large one makes a large segment
+    jit_lowering lowering(*module, status.mode, status.ring_mask);
+    std::unordered_map<const brainfuck_block *, size_t> sizes;
+    const brainfuck_block & code = program.code;
+    size_t segments = 0;
+    size_t from = 0;
+    do {
+        size_t to = from;
+        for (size_t ops = 0; to < code.ops.size() && ops < PICO_BF_HOST_JIT_SEGMENT_OPS; to++) {
+            const loop_ir * loop = std::get_if<loop_ir>(&code.ops[to]);
+            ops += 1 + (loop ? lowered_ops(*loop->body, sizes) : 0);
+        }
+        lowering.begin_segment(PICO_BF_HOST_JIT_SEGMENT + std::to_string(segments++));
+        lowering.lower_block(code, from, to);
+        lowering.finish_segment();
+        from = to;
+    } while (from < code.ops.size());
+    if (llvm::verifyModule(*module, &llvm::errs())) {
+        error = "lowered an invalid LLVM module";
+        return nullptr;
+    }
+    optimise(*module, **machine, opt_level);
+
+    // the callbacks are resolved to this process
+    llvm::orc::MangleAndInterner mangle((*jit)->getExecutionSession(), (*jit)->getDataLayout());
+    llvm::orc::SymbolMap callbacks;
+    callbacks[mangle("pico_bf_jit_put")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&pico_bf_jit_put), llvm::JITSymbolFlags::Exported);
+    callbacks[mangle("pico_bf_jit_get")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&pico_bf_jit_get), llvm::JITSymbolFlags::Exported);
+    if (auto failed = (*jit)->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(callbacks)))) {
+        error = llvm::toString(std::move(failed));
+        return nullptr;
+    }
+    if (auto failed = (*jit)->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+        error = llvm::toString(std::move(failed));
+        return nullptr;
+    }
+
+    auto compiled = std::make_shared<jit_program>();
+    for (size_t i = 0; i < segments; i++) {
+        auto segment = (*jit)->lookup(PICO_BF_HOST_JIT_SEGMENT + std::to_string(i));
+        if (!segment) {
+            error = llvm::toString(segment.takeError());
+            return nullptr;
+        }
+        compiled->segments.push_back(llvm::jitTargetAddressToFunction<jit_segment>(segment->getAddress()));
+    }
+    compiled->jit = std::move(*jit);
+    compiled->mode = status.mode;
+    return compiled;
+}
+
+void run_jit(brainfuck_vm_status & status, const jit_program & program) {
+    bool ring = program.mode == tape_mode::ring;
+    char * cells = ring ? status.ring.data() : status.bounded.data();
+    int32_t offset = ring ? status.tape_ptr : status.tape_ptr - status.bounded_base;
+    for (jit_segment segment : program.segments) {
+        status.instruction_executed += segment(cells, &offset, status.io);
+    }
+    status.tape_ptr = ring ? offset : offset + status.bounded_base;
+}
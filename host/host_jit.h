@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+
+#pragma mark - LLVM jit
+
+// only built when LLVM was found, which defines PICO_BF_HOST_JIT
+//
+// the compiled IR is lowered to an LLVM function, optimised at -O2 or -O3 and compiled to
+// machine code by ORC: a loop becomes a test and a do-while, the tape pointer stays in a
+// register, and only `.` and `,` call back into the brainfuck_io
+//
+// the machine code runs like run_vm, to the end in one go: there is no fuel and a `,` blocks,
+// so it is for programs known to finish, validation and benchmarking runs on the host
+
+/// a program compiled to machine code for one kind of tape, with the LLVM jit that owns the code,
+/// only held through the shared_ptr of jit_compile so its LLVM types stay out of this header
+struct jit_program;
+
+/**
+ compile a program to machine code for the tape a vm has, run_jit then needs a tape like it
+
+ @param program   compiled program
+ @param status    vm with a bounded or ring tape, an infinite tape has no flat cells to address
+ @param opt_level LLVM optimisation level, 2 or 3
+ @param error     set to why it failed
+ @return the program, or nullptr
+*/
+std::shared_ptr<const jit_program> jit_compile(const brainfuck_program & program, const brainfuck_vm_status & status,
+                                              unsigned opt_level, std::string & error);
+
+/**
+ run a jit compiled program to its end, counting the same ops as run_compiled
+
+ @param status  the brainfuck vm status, its tape set up as for jit_compile
+ @param program the jit compiled program
+*/
+void run_jit(brainfuck_vm_status & status, const jit_program & program);
+
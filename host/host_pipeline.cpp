@@ -0,0 +1,139 @@
+#include "host_pipeline.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include "brainfuck_queue.h"
+
+#pragma mark - pipelined execution
+
+/// commands of a part of the source at bracket depth 0
+struct source_segment {
+    std::string ops;
+    /// no segment follows
+    bool last = false;
+    /// the source is unbalanced right after this segment
+    bool unbalanced = false;
+};
+
+/// a source_segment once compiled
+struct compiled_segment {
+    /// null for an empty segment
+    std::shared_ptr<const brainfuck_block> program;
+    bool last = false;
+    bool unbalanced = false;
+};
+
+using segment_queue = spsc_queue<source_segment, PICO_BF_HOST_PIPELINE_DEPTH>;
+using program_queue = spsc_queue<compiled_segment, PICO_BF_HOST_PIPELINE_DEPTH>;
+
+/**
+ first stage, strip comments and cut the source after top-level loops
+
+ @param source      brainfuck source
+ @param len         length of source
+ @param segment_ops ops a segment collects before it is cut
+ @param out         queue to the compiler
+ @param cancelled   set when the run stops early
+*/
+static void tokenise_stage(const char * source, size_t len, size_t segment_ops, segment_queue & out, const std::atomic<bool> & cancelled) {
+    source_segment segment;
+    size_t depth = 0;
+    // ops of the segment up to where the depth was last 0, the part that compiles on its own
+    size_t balanced = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = source[i];
+        switch (c) {
+            case '+': case '-': case '>': case '<': case '.': case ',':
+                segment.ops.push_back(c);
+                if (depth == 0) balanced = segment.ops.size();
+                break;
+            case '[':
+                depth++;
+                segment.ops.push_back(c);
+                break;
+            case ']':
+                if (depth == 0) {
+                    segment.last = true;
+                    segment.unbalanced = true;
+                    out.push(std::move(segment), cancelled, std::this_thread::yield);
+                    return;
+                }
+                depth--;
+                segment.ops.push_back(c);
+                if (depth == 0) balanced = segment.ops.size();
+                if (depth == 0 && segment.ops.size() >= segment_ops) {
+                    if (!out.push(std::move(segment), cancelled, std::this_thread::yield)) {
+                        return;
+                    }
+                    segment = source_segment();
+                    balanced = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // an unclosed loop is dropped, the ops of the segment before it still run
+    if (depth > 0) {
+        segment.ops.resize(balanced);
+        segment.unbalanced = true;
+    }
+    segment.last = true;
+    out.push(std::move(segment), cancelled, std::this_thread::yield);
+}
+
+/**
+ second stage, compile every segment
+
+ @param in        queue from the tokeniser
+ @param out       queue to the executor
+ @param cancelled set when the run stops early
+*/
+static void compile_stage(segment_queue & in, program_queue & out, const std::atomic<bool> & cancelled) {
+    source_segment segment;
+    while (in.pop(segment, cancelled, std::this_thread::yield)) {
+        compiled_segment compiled;
+        compiled.last = segment.last;
+        compiled.unbalanced = segment.unbalanced;
+        if (!segment.ops.empty()) {
+            // segments are cut at depth 0, they always compile
+            compiled.program = std::make_shared<const brainfuck_block>(*compile_bf(segment.ops.data(), segment.ops.size()));
+        }
+        if (!out.push(std::move(compiled), cancelled, std::this_thread::yield) || segment.last) {
+            return;
+        }
+    }
+}
+
+pipeline_result run_pipelined(brainfuck_vm_status & status, const char * source, size_t len, size_t segment_ops) {
+    std::atomic<bool> cancelled{false};
+    auto segments = std::make_unique<segment_queue>();
+    auto programs = std::make_unique<program_queue>();
+    std::thread tokeniser(tokenise_stage, source, len, segment_ops, std::ref(*segments), std::cref(cancelled));
+    std::thread compiler(compile_stage, std::ref(*segments), std::ref(*programs), std::cref(cancelled));
+
+    // the last stage runs on this thread, every segment continues on the tape the previous one left
+    pipeline_result outcome;
+    compiled_segment segment;
+    while (programs->pop(segment, cancelled, std::this_thread::yield)) {
+        if (segment.program) {
+            load_program(status, std::move(segment.program));
+            outcome.segments++;
+            outcome.result = run_compiled(status);
+            if (outcome.result != run_result::finished) {
+                break;
+            }
+        }
+        if (segment.last) {
+            outcome.balanced = !segment.unbalanced;
+            break;
+        }
+    }
+
+    cancelled = true;
+    tokeniser.join();
+    compiler.join();
+    return outcome;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+
+/// ops a segment collects before the pipeline cuts it after the next top-level loop
+#define PICO_BF_HOST_SEGMENT_OPS (1 << 16)
+/// segments each queue of the pipeline holds
+#define PICO_BF_HOST_PIPELINE_DEPTH 16
+
+#pragma mark - pipelined execution
+
+/// outcome of run_pipelined
+struct pipeline_result {
+    run_result result = run_result::finished;
+    /// false if the brackets turned out unbalanced, the segments before that have already run
+    bool balanced = true;
+    /// segments compiled and run
+    size_t segments = 0;
+};
+
+/**
+ compile and run a program in segments cut after top-level loops, so it starts running
+ before the whole source is compiled
+
+ a tokeniser thread strips comments and cuts the source, a compiler thread compiles each
+ segment and the calling thread runs them one after the other on the same tape; the stages
+ hand segments over through bounded lock-free queues, the op count is the same as compiling
+ the whole program because folding never crosses a loop
+
+ @param status      the brainfuck vm status, with its tape and fuel set up
+ @param source      brainfuck source
+ @param len         length of source
+ @param segment_ops ops a segment collects before it is cut
+ @return pipeline_result
+*/
+pipeline_result run_pipelined(brainfuck_vm_status & status, const char * source, size_t len,
+                              size_t segment_ops = PICO_BF_HOST_SEGMENT_OPS);
@@ -0,0 +1,229 @@
+#include "host_scan.h"
+#include <algorithm>
+#include <array>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#pragma mark - source scanning
+
+/// whether a byte is one of the eight commands
+static const std::array<bool, 256> command_table = [] {
+    std::array<bool, 256> table{};
+    for (char c : {'+', '-', '>', '<', '.', ',', '[', ']'}) {
+        table[(unsigned char)c] = true;
+    }
+    return table;
+}();
+
+scanned_source scan_bf_sequential(const char * source, size_t len) {
+    scanned_source scanned;
+    int64_t depth = 0;
+    // commands up to the last point at depth 0, a `[` that is never closed comes right after it
+    uint32_t last_zero = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = source[i];
+        if (!command_table[(unsigned char)c]) {
+            continue;
+        }
+        uint32_t pc = uint32_t(scanned.ops.size());
+        scanned.ops.push_back(c);
+        if (c == '[') {
+            depth++;
+        } else if (c == ']' && --depth < 0 && scanned.balanced) {
+            scanned.first_unmatched = pc;
+            scanned.balanced = false;
+        }
+        if (depth == 0) {
+            last_zero = pc + 1;
+        }
+    }
+    if (scanned.balanced && depth > 0) {
+        scanned.first_unmatched = last_zero;
+        scanned.balanced = false;
+    }
+    return scanned;
+}
+
+/// what one thread made of its part of the source
+struct scan_chunk {
+    const char * source = nullptr;
+    size_t len = 0;
+    /// commands in the chunk, then where they go in the scanned_source
+    size_t ops = 0;
+    size_t op_offset = 0;
+    /// bracket depth at the end of the chunk and the lowest one within it, relative to its start
+    int64_t depth = 0;
+    int64_t low = 0;
+};
+
+#if defined(__SSE2__)
+/**
+ classify 16 bytes
+
+ @param bytes    the bytes
+ @param brackets set to the mask of `[` and `]`
+ @return mask of the commands, bit i for byte i
+*/
+static inline uint32_t command_mask(const char * bytes, uint32_t & brackets) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+    __m128i open = _mm_cmpeq_epi8(v, _mm_set1_epi8('['));
+    __m128i close = _mm_cmpeq_epi8(v, _mm_set1_epi8(']'));
+    __m128i bracket = _mm_or_si128(open, close);
+    __m128i other = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')), _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<')))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    brackets = uint32_t(_mm_movemask_epi8(bracket));
+    return uint32_t(_mm_movemask_epi8(_mm_or_si128(bracket, other)));
+}
+#endif
+
+/**
+ first pass over a chunk, count its commands and follow the bracket depth
+
+ @param chunk the chunk
+*/
+static void count_chunk(scan_chunk & chunk) {
+    auto bracket = [&chunk](char c) {
+        chunk.depth += c == '[' ? 1 : -1;
+        chunk.low = std::min(chunk.low, chunk.depth);
+    };
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= chunk.len; i += 16) {
+        uint32_t brackets;
+        uint32_t commands = command_mask(chunk.source + i, brackets);
+        chunk.ops += __builtin_popcount(commands);
+        for (; brackets; brackets &= brackets - 1) {
+            bracket(chunk.source[i + __builtin_ctz(brackets)]);
+        }
+    }
+#endif
+    for (; i < chunk.len; i++) {
+        char c = chunk.source[i];
+        chunk.ops += command_table[(unsigned char)c];
+        if (c == '[' || c == ']') {
+            bracket(c);
+        }
+    }
+}
+
+/**
+ second pass over a chunk, copy its commands out
+
+ @param chunk   the chunk, with its offset filled in
+ @param scanned where the commands go
+*/
+static void copy_chunk(const scan_chunk & chunk, scanned_source & scanned) {
+    char * ops = scanned.ops.data() + chunk.op_offset;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= chunk.len; i += 16) {
+        uint32_t brackets;
+        for (uint32_t commands = command_mask(chunk.source + i, brackets); commands; commands &= commands - 1) {
+            *ops++ = chunk.source[i + __builtin_ctz(commands)];
+        }
+    }
+#endif
+    for (; i < chunk.len; i++) {
+        char c = chunk.source[i];
+        if (command_table[(unsigned char)c]) {
+            *ops++ = c;
+        }
+    }
+}
+
+/**
+ walk the copied commands of the chunk holding the first unmatched bracket
+
+ @param chunk   the chunk
+ @param scanned the commands
+ @param depth   bracket depth at the start of the chunk
+ @param close   look for the first `]` taking the depth below 0, rather than the last point
+                at depth 0, which a `[` that is never closed follows
+ @return instruction index of the unmatched bracket
+*/
+static uint32_t find_unmatched(const scan_chunk & chunk, const scanned_source & scanned, int64_t depth, bool close) {
+    uint32_t last_zero = uint32_t(chunk.op_offset);
+    for (size_t pc = chunk.op_offset; pc < chunk.op_offset + chunk.ops; pc++) {
+        char c = scanned.ops[pc];
+        if (c == '[') {
+            depth++;
+        } else if (c == ']' && --depth < 0 && close) {
+            return uint32_t(pc);
+        }
+        if (depth == 0) {
+            last_zero = uint32_t(pc + 1);
+        }
+    }
+    return last_zero;
+}
+
+/**
+ run a pass on every chunk, one thread each
+
+ @param chunks the chunks
+ @param pass   what to do with a chunk
+*/
+template <typename Pass>
+static void for_each_chunk(std::vector<scan_chunk> & chunks, Pass pass) {
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++) {
+        workers.emplace_back(pass, std::ref(chunks[i]));
+    }
+    pass(chunks[0]);
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+scanned_source scan_bf(const char * source, size_t len, unsigned threads, size_t min_chunk) {
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    size_t count = std::max<size_t>(std::min<size_t>(threads, len / std::max<size_t>(min_chunk, 1)), 1);
+    std::vector<scan_chunk> chunks(count);
+    for (size_t i = 0; i < count; i++) {
+        size_t begin = len * i / count;
+        chunks[i].source = source + begin;
+        chunks[i].len = len * (i + 1) / count - begin;
+    }
+
+    for_each_chunk(chunks, count_chunk);
+
+    // counts to offsets
+    scanned_source scanned;
+    size_t ops = 0;
+    for (auto & chunk : chunks) {
+        chunk.op_offset = ops;
+        ops += chunk.ops;
+    }
+    scanned.ops.resize(ops);
+
+    for_each_chunk(chunks, [&](scan_chunk & chunk) { copy_chunk(chunk, scanned); });
+
+    // add up the depths, the first chunk dipping below 0 holds a stray `]`, otherwise a `[` left
+    // open at the end follows the last point at depth 0, in the last chunk that reaches 0
+    int64_t depth = 0;
+    const scan_chunk * zero_chunk = &chunks[0];
+    int64_t zero_depth = 0;
+    for (const auto & chunk : chunks) {
+        if (depth + chunk.low < 0) {
+            scanned.balanced = false;
+            scanned.first_unmatched = find_unmatched(chunk, scanned, depth, true);
+            return scanned;
+        }
+        if (depth + chunk.low == 0) {
+            zero_chunk = &chunk;
+            zero_depth = depth;
+        }
+        depth += chunk.depth;
+    }
+    if (depth > 0) {
+        scanned.balanced = false;
+        scanned.first_unmatched = find_unmatched(*zero_chunk, scanned, zero_depth, false);
+    }
+    return scanned;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// sources shorter than this per thread are scanned on fewer threads
+#define PICO_BF_HOST_SCAN_MIN_CHUNK (1 << 20)
+/// first_unmatched of a balanced source
+#define PICO_BF_HOST_SCAN_UNMATCHED UINT32_MAX
+
+#pragma mark - source scanning
+
+/// brainfuck source reduced to its commands, with whether its brackets balance,
+/// the compiler matches the brackets itself as it builds the loops
+struct scanned_source {
+    /// commands in source order, comments dropped, indices are instruction indices
+    std::vector<char> ops;
+    /// every bracket has a partner
+    bool balanced = true;
+    /// instruction index of the first bracket without a partner, if not balanced
+    uint32_t first_unmatched = PICO_BF_HOST_SCAN_UNMATCHED;
+};
+
+/**
+ scan a source one character at a time, the reference for scan_bf
+
+ @param source brainfuck source
+ @param len    length of source
+ @return scanned_source
+*/
+scanned_source scan_bf_sequential(const char * source, size_t len);
+
+/**
+ scan a source on several threads, with the same result as scan_bf_sequential
+
+ every thread classifies its chunk 16 bytes at a time with SSE2 (or bytewise without it),
+ counts its commands and the net and lowest bracket depth it reaches, then, once the counts
+ are turned into offsets, copies its commands out; the depths of the chunks add up to whether
+ the source balances, and only the chunk holding the first unmatched bracket is walked again
+ to find it
+
+ @param source    brainfuck source
+ @param len       length of source
+ @param threads   threads to use, 0 for one per core
+ @param min_chunk fewest bytes worth a thread of their own
+ @return scanned_source
+*/
+scanned_source scan_bf(const char * source, size_t len, unsigned threads = 0, size_t min_chunk = PICO_BF_HOST_SCAN_MIN_CHUNK);
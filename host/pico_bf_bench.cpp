@@ -0,0 +1,85 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include "brainfuck_bench.h"
+#include "host_clock.h"
+#include "host_io.h"
+
+/// timed runs per program unless -n says otherwise
+#define PICO_BF_BENCH_REPEATS 10
+
+/**
+ print usage to stderr
+
+ @param name argv[0]
+*/
+void usage(const char * name) {
+    fprintf(stderr,
+            "usage: %s [-n repeats] [-o results.json] program.bf...\n"
+            "  -n, --repeats N   timed runs per program (default: %d)\n"
+            "  -o, --output FILE write the JSON results there instead of stdout\n",
+            name, PICO_BF_BENCH_REPEATS);
+}
+
+int main(int argc, char ** argv) {
+    static const struct option long_options[] = {
+        {"repeats", required_argument, nullptr, 'n'},
+        {"output", required_argument, nullptr, 'o'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    unsigned repeats = PICO_BF_BENCH_REPEATS;
+    const char * output_path = nullptr;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:o:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'n':
+                repeats = unsigned(strtoul(optarg, nullptr, 10));
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind == argc || repeats == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    host_clock clock;
+    std::vector<bench_result> results;
+    for (int i = optind; i < argc; i++) {
+        mapped_file file;
+        std::vector<char> fallback;
+        const char * source = nullptr;
+        size_t len = 0;
+        if (!load_file(argv[i], file, fallback, source, len)) {
+            return 1;
+        }
+
+        // programs are named after their file
+        const char * name = strrchr(argv[i], '/');
+        name = name ? name + 1 : argv[i];
+        results.push_back(run_benchmark(clock, name, source, len, repeats));
+        if (!results.back().compiled) {
+            fprintf(stderr, "%s: unbalanced brackets\n", argv[i]);
+        }
+    }
+
+    FILE * out = output_path ? fopen(output_path, "w") : stdout;
+    if (!out) {
+        perror(output_path);
+        return 1;
+    }
+    print_bench_json(out, "host", clock.get_khz(), results);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
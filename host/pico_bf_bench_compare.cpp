@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <getopt.h>
+#include "brainfuck_bench.h"
+#include "host_io.h"
+
+/// slowdowns below this fraction of the baseline are never reported
+#define PICO_BF_COMPARE_THRESHOLD 0.02
+/// significance level of the t-test
+#define PICO_BF_COMPARE_ALPHA 0.05
+
+/// exit status when a program got significantly slower
+#define PICO_BF_COMPARE_EXIT_REGRESSION 1
+/// exit status when the files cannot be read or compared
+#define PICO_BF_COMPARE_EXIT_ERROR 2
+
+#pragma mark - json
+
+/// parsed JSON value, just enough for the files print_bench_json writes
+struct json_value {
+    enum class kind { null, boolean, number, string, array, object } type = kind::null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> array;
+    std::vector<std::pair<std::string, json_value>> object;
+
+    /**
+     member of an object
+
+     @param key member name
+     @return the member, nullptr if this is not an object or has no such member
+    */
+    const json_value * get(const char * key) const {
+        for (const auto & member : object) {
+            if (member.first == key) return &member.second;
+        }
+        return nullptr;
+    }
+
+    /**
+     numeric member of an object
+
+     @param key      member name
+     @param fallback value when the member is missing or not a number
+     @return the number
+    */
+    double number_at(const char * key, double fallback = 0) const {
+        const json_value * value = get(key);
+        return value && value->type == kind::number ? value->number : fallback;
+    }
+};
+
+/// recursive descent JSON parser
+struct json_parser {
+    const char * pos;
+    const char * end;
+
+    void skip_space() {
+        while (pos < end && isspace(static_cast<unsigned char>(*pos))) pos++;
+    }
+
+    bool literal(const char * word) {
+        size_t len = strlen(word);
+        if (size_t(end - pos) < len || strncmp(pos, word, len) != 0) return false;
+        pos += len;
+        return true;
+    }
+
+    bool parse_string(std::string & out) {
+        if (pos == end || *pos != '"') return false;
+        pos++;
+        while (pos < end && *pos != '"') {
+            char c = *pos++;
+            if (c == '\\') {
+                if (pos == end) return false;
+                char escaped = *pos++;
+                switch (escaped) {
+                    case 'n': out.push_back('\n'); break;
+                    case 't': out.push_back('\t'); break;
+                    case 'r': out.push_back('\r'); break;
+                    case 'b': out.push_back('\b'); break;
+                    case 'f': out.push_back('\f'); break;
+                    case 'u': {
+                        // names are ASCII, anything else is kept as '?'
+                        if (end - pos < 4) return false;
+                        unsigned long code = strtoul(std::string(pos, 4).c_str(), nullptr, 16);
+                        out.push_back(code < 0x80 ? char(code) : '?');
+                        pos += 4;
+                        break;
+                    }
+                    default: out.push_back(escaped); break;
+                }
+            } else {
+                out.push_back(c);
+            }
+        }
+        if (pos == end) return false;
+        pos++;
+        return true;
+    }
+
+    bool parse(json_value & value) {
+        skip_space();
+        if (pos == end) return false;
+        if (*pos == '{') {
+            value.type = json_value::kind::object;
+            pos++;
+            skip_space();
+            if (pos < end && *pos == '}') { pos++; return true; }
+            for (;;) {
+                std::pair<std::string, json_value> member;
+                skip_space();
+                if (!parse_string(member.first)) return false;
+                skip_space();
+                if (pos == end || *pos++ != ':') return false;
+                if (!parse(member.second)) return false;
+                value.object.push_back(std::move(member));
+                skip_space();
+                if (pos == end) return false;
+                if (*pos == ',') { pos++; continue; }
+                if (*pos == '}') { pos++; return true; }
+                return false;
+            }
+        }
+        if (*pos == '[') {
+            value.type = json_value::kind::array;
+            pos++;
+            skip_space();
+            if (pos < end && *pos == ']') { pos++; return true; }
+            for (;;) {
+                value.array.emplace_back();
+                if (!parse(value.array.back())) return false;
+                skip_space();
+                if (pos == end) return false;
+                if (*pos == ',') { pos++; continue; }
+                if (*pos == ']') { pos++; return true; }
+                return false;
+            }
+        }
+        if (*pos == '"') {
+            value.type = json_value::kind::string;
+            return parse_string(value.string);
+        }
+        if (literal("true")) { value.type = json_value::kind::boolean; value.boolean = true; return true; }
+        if (literal("false")) { value.type = json_value::kind::boolean; return true; }
+        if (literal("null")) return true;
+
+        char * number_end = nullptr;
+        std::string number(pos, size_t(std::min<ptrdiff_t>(end - pos, 64)));
+        value.number = strtod(number.c_str(), &number_end);
+        if (number_end == number.c_str()) return false;
+        value.type = json_value::kind::number;
+        pos += number_end - number.c_str();
+        return true;
+    }
+};
+
+/**
+ read a benchmark result file
+
+ @param path  path of the file
+ @param value the parsed document
+ @return whether the file is a benchmark result of a known schema, an error is printed otherwise
+*/
+bool load_results(const char * path, json_value & value) {
+    mapped_file file;
+    std::vector<char> fallback;
+    const char * data = nullptr;
+    size_t len = 0;
+    if (!load_file(path, file, fallback, data, len)) {
+        return false;
+    }
+
+    json_parser parser {data, data + len};
+    if (!parser.parse(value) || value.type != json_value::kind::object) {
+        fprintf(stderr, "%s: not valid JSON\n", path);
+        return false;
+    }
+    if (value.number_at("schema") != BRAINFUCK_BENCH_SCHEMA) {
+        fprintf(stderr, "%s: unknown schema, expected %d\n", path, BRAINFUCK_BENCH_SCHEMA);
+        return false;
+    }
+    const json_value * programs = value.get("programs");
+    if (!programs || programs->type != json_value::kind::array) {
+        fprintf(stderr, "%s: no programs\n", path);
+        return false;
+    }
+    return true;
+}
+
+#pragma mark - statistics
+
+/// mean and variance of a set of samples
+struct sample_stats {
+    size_t count = 0;
+    double mean = 0;
+    /// unbiased sample variance, 0 with fewer than 2 samples
+    double variance = 0;
+};
+
+/**
+ mean and variance of the wall time samples of a program
+
+ @param program a program of a result file
+ @return sample_stats
+*/
+sample_stats wall_time_stats(const json_value & program) {
+    sample_stats stats;
+    const json_value * samples = program.get("samples_us");
+    if (!samples || samples->array.empty()) {
+        // older or hand written files only have the median
+        stats.count = 1;
+        stats.mean = program.number_at("wall_us");
+        return stats;
+    }
+
+    stats.count = samples->array.size();
+    for (const auto & sample : samples->array) stats.mean += sample.number;
+    stats.mean /= double(stats.count);
+    if (stats.count > 1) {
+        for (const auto & sample : samples->array) {
+            stats.variance += (sample.number - stats.mean) * (sample.number - stats.mean);
+        }
+        stats.variance /= double(stats.count - 1);
+    }
+    return stats;
+}
+
+/**
+ continued fraction of the regularised incomplete beta function
+
+ @param a first shape parameter
+ @param b second shape parameter
+ @param x point in [0, 1]
+ @return the continued fraction
+*/
+double beta_fraction(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (std::fabs(d) < tiny ? tiny : d);
+    double h = d;
+    for (int m = 1; m <= 200; m++) {
+        double m2 = 2.0 * m;
+        double numerator = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+        d = 1 / (std::fabs(1 + numerator * d) < tiny ? tiny : 1 + numerator * d);
+        c = std::fabs(1 + numerator / c) < tiny ? tiny : 1 + numerator / c;
+        h *= d * c;
+        numerator = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+        d = 1 / (std::fabs(1 + numerator * d) < tiny ? tiny : 1 + numerator * d);
+        c = std::fabs(1 + numerator / c) < tiny ? tiny : 1 + numerator / c;
+        double delta = d * c;
+        h *= delta;
+        if (std::fabs(delta - 1) < 1e-12) break;
+    }
+    return h;
+}
+
+/**
+ regularised incomplete beta function I_x(a, b)
+
+ @param a first shape parameter
+ @param b second shape parameter
+ @param x point in [0, 1]
+ @return I_x(a, b)
+*/
+double incomplete_beta(double a, double b, double x) {
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x));
+    if (x < (a + 1) / (a + b + 2)) {
+        return front * beta_fraction(a, b, x) / a;
+    }
+    return 1 - front * beta_fraction(b, a, 1 - x) / b;
+}
+
+/**
+ two-sided p-value of Welch's t-test
+
+ @param base      baseline samples
+ @param candidate candidate samples
+ @return p-value, 1 if there are too few samples to tell
+*/
+double welch_p_value(const sample_stats & base, const sample_stats & candidate) {
+    if (base.count < 2 || candidate.count < 2) {
+        return 1;
+    }
+    double base_error = base.variance / double(base.count);
+    double candidate_error = candidate.variance / double(candidate.count);
+    double error = base_error + candidate_error;
+    if (error == 0) {
+        // no noise at all, any difference is real
+        return base.mean == candidate.mean ? 1 : 0;
+    }
+    double t = (candidate.mean - base.mean) / std::sqrt(error);
+    double df = error * error / (base_error * base_error / double(base.count - 1) +
+                                 candidate_error * candidate_error / double(candidate.count - 1));
+    return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+#pragma mark - main
+
+/**
+ print usage to stderr
+
+ @param name argv[0]
+*/
+void usage(const char * name) {
+    fprintf(stderr,
+            "usage: %s [-t threshold] [-a alpha] baseline.json candidate.json\n"
+            "  -t, --threshold F  ignore slowdowns below this fraction (default: %g)\n"
+            "  -a, --alpha P      significance level of Welch's t-test (default: %g)\n"
+            "exits with %d if any program is significantly slower\n",
+            name, PICO_BF_COMPARE_THRESHOLD, PICO_BF_COMPARE_ALPHA, PICO_BF_COMPARE_EXIT_REGRESSION);
+}
+
+int main(int argc, char ** argv) {
+    static const struct option long_options[] = {
+        {"threshold", required_argument, nullptr, 't'},
+        {"alpha", required_argument, nullptr, 'a'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    double threshold = PICO_BF_COMPARE_THRESHOLD;
+    double alpha = PICO_BF_COMPARE_ALPHA;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:a:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 't':
+                threshold = strtod(optarg, nullptr);
+                break;
+            case 'a':
+                alpha = strtod(optarg, nullptr);
+                break;
+            default:
+                usage(argv[0]);
+                return PICO_BF_COMPARE_EXIT_ERROR;
+        }
+    }
+    if (optind + 2 != argc) {
+        usage(argv[0]);
+        return PICO_BF_COMPARE_EXIT_ERROR;
+    }
+
+    json_value base, candidate;
+    if (!load_results(argv[optind], base) || !load_results(argv[optind + 1], candidate)) {
+        return PICO_BF_COMPARE_EXIT_ERROR;
+    }
+
+    const json_value * base_platform = base.get("platform");
+    const json_value * candidate_platform = candidate.get("platform");
+    if (base_platform && candidate_platform && base_platform->string != candidate_platform->string) {
+        printf("warning: comparing %s against %s\n", candidate_platform->string.c_str(), base_platform->string.c_str());
+    }
+    if (base.number_at("khz") != candidate.number_at("khz")) {
+        printf("warning: clocks differ, %.0f kHz against %.0f kHz\n", candidate.number_at("khz"), base.number_at("khz"));
+    }
+
+    int regressions = 0;
+    printf("%-24s %12s %12s %8s %8s  %s\n", "program", "base us", "new us", "change", "p", "verdict");
+    for (const auto & program : candidate.get("programs")->array) {
+        const json_value * name = program.get("name");
+        if (!name) continue;
+        const json_value * match = nullptr;
+        for (const auto & other : base.get("programs")->array) {
+            const json_value * other_name = other.get("name");
+            if (other_name && other_name->string == name->string) match = &other;
+        }
+        if (!match) {
+            printf("%-24s %12s %12.0f %8s %8s  new\n", name->string.c_str(), "-", program.number_at("wall_us"), "-", "-");
+            continue;
+        }
+
+        sample_stats before = wall_time_stats(*match);
+        sample_stats after = wall_time_stats(program);
+        double change = before.mean > 0 ? (after.mean - before.mean) / before.mean : 0;
+        double p = welch_p_value(before, after);
+        const char * verdict = "same";
+        if (change > threshold && p < alpha) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (change < -threshold && p < alpha) {
+            verdict = "faster";
+        } else if (std::fabs(change) > threshold) {
+            verdict = "noise";
+        }
+        printf("%-24s %12.0f %12.0f %+7.1f%% %8.3f  %s\n",
+               name->string.c_str(), before.mean, after.mean, change * 100, p, verdict);
+
+        // a different op count or output means the engine now does something else, not just at another speed
+        if (match->number_at("instructions") != program.number_at("instructions")) {
+            printf("%-24s instructions %.0f -> %.0f\n", "", match->number_at("instructions"), program.number_at("instructions"));
+        }
+        if (match->number_at("output_bytes") != program.number_at("output_bytes")) {
+            printf("%-24s output bytes %.0f -> %.0f\n", "", match->number_at("output_bytes"), program.number_at("output_bytes"));
+        }
+        // memory is listed the same way, a heap_peak only when both platforms measured one
+        const json_value * memory_before = match->get("memory");
+        const json_value * memory_after = program.get("memory");
+        for (const char * field : {"heap_peak", "tape_bytes", "ir_bytes"}) {
+            if (memory_before && memory_after && memory_before->get(field) && memory_after->get(field) &&
+                memory_before->number_at(field) != memory_after->number_at(field)) {
+                printf("%-24s %s %.0f -> %.0f\n", "", field, memory_before->number_at(field), memory_after->number_at(field));
+            }
+        }
+        const json_value * digest_before = match->get("output_digest");
+        const json_value * digest_after = program.get("output_digest");
+        if (digest_before && digest_after && digest_before->string != digest_after->string) {
+            printf("%-24s output digest %s -> %s\n", "", digest_before->string.c_str(), digest_after->string.c_str());
+        }
+    }
+
+    if (regressions) {
+        printf("%d program%s significantly slower\n", regressions, regressions == 1 ? "" : "s");
+        return PICO_BF_COMPARE_EXIT_REGRESSION;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <utility>
+#include <vector>
+#include "brainfuck_clock.h"
+
+#pragma mark - recording clock
+
+/// what scale_clock asked the clock to do
+struct clock_call {
+    enum { voltage, khz } kind;
+    /// the voltage as an int, or the clock in kHz
+    uint32_t value;
+
+    bool operator==(const clock_call & other) const {
+        return kind == other.kind && value == other.value;
+    }
+};
+
+/// clock_control that only records the calls it gets, and can be told to fail set_khz
+struct recording_clock : clock_control {
+    uint32_t khz;
+    core_voltage voltage;
+    std::set<uint32_t> supported;
+    bool fail_set_khz = false;
+    std::vector<clock_call> calls;
+
+    recording_clock(uint32_t khz, std::set<uint32_t> supported)
+        : khz(khz), voltage(voltage_for_khz(khz)), supported(std::move(supported)) {
+    }
+
+    uint32_t get_khz() const override {
+        return khz;
+    }
+
+    bool can_set_khz(uint32_t khz) const override {
+        return supported.count(khz) != 0;
+    }
+
+    bool set_khz(uint32_t khz) override {
+        calls.push_back({clock_call::khz, khz});
+        if (fail_set_khz) {
+            return false;
+        }
+        this->khz = khz;
+        return true;
+    }
+
+    void set_voltage(core_voltage voltage) override {
+        calls.push_back({clock_call::voltage, uint32_t(voltage)});
+        this->voltage = voltage;
+    }
+
+    uint64_t now_us() const override {
+        return 0;
+    }
+};
+
+#pragma mark - tests
+
+/// clocks the recording clock can generate in every test
+static const std::set<uint32_t> supported_khz = {
+    BRAINFUCK_CLOCK_NORMAL_KHZ, 200000, BRAINFUCK_CLOCK_BOOST_KHZ, BRAINFUCK_CLOCK_MAX_KHZ
+};
+
+/// checks that failed so far
+static int failures = 0;
+
+/**
+ report a failed check
+
+ @param ok   the check
+ @param what what was checked
+*/
+static void check(bool ok, const char * what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/// the call setting a voltage
+static clock_call voltage_call(core_voltage voltage) {
+    return {clock_call::voltage, uint32_t(voltage)};
+}
+
+/// the call setting a clock
+static clock_call khz_call(uint32_t khz) {
+    return {clock_call::khz, khz};
+}
+
+/// speeding up raises the voltage first
+static void test_speed_up() {
+    recording_clock clock(BRAINFUCK_CLOCK_NORMAL_KHZ, supported_khz);
+    check(scale_clock(clock, BRAINFUCK_CLOCK_BOOST_KHZ), "speeding up succeeds");
+    std::vector<clock_call> expected = {voltage_call(voltage_for_khz(BRAINFUCK_CLOCK_BOOST_KHZ)), khz_call(BRAINFUCK_CLOCK_BOOST_KHZ)};
+    check(clock.calls == expected, "speeding up raises the voltage before the clock");
+    check(clock.khz == BRAINFUCK_CLOCK_BOOST_KHZ && clock.voltage == voltage_for_khz(BRAINFUCK_CLOCK_BOOST_KHZ),
+          "speeding up ends at the new clock and voltage");
+}
+
+/// slowing down lowers the voltage last
+static void test_slow_down() {
+    recording_clock clock(BRAINFUCK_CLOCK_BOOST_KHZ, supported_khz);
+    check(scale_clock(clock, BRAINFUCK_CLOCK_NORMAL_KHZ), "slowing down succeeds");
+    std::vector<clock_call> expected = {khz_call(BRAINFUCK_CLOCK_NORMAL_KHZ), voltage_call(voltage_for_khz(BRAINFUCK_CLOCK_NORMAL_KHZ))};
+    check(clock.calls == expected, "slowing down lowers the voltage after the clock");
+    check(clock.khz == BRAINFUCK_CLOCK_NORMAL_KHZ && clock.voltage == voltage_for_khz(BRAINFUCK_CLOCK_NORMAL_KHZ),
+          "slowing down ends at the new clock and voltage");
+}
+
+/// the voltage is only touched when it changes
+static void test_same_voltage() {
+    recording_clock clock(BRAINFUCK_CLOCK_BOOST_KHZ, supported_khz);
+    check(scale_clock(clock, BRAINFUCK_CLOCK_BOOST_KHZ) && clock.calls.empty(), "the current clock is left alone");
+    check(voltage_for_khz(200000) == voltage_for_khz(200000 - 1000), "200 MHz and 199 MHz share a voltage");
+    recording_clock near(200000, {200000 - 1000});
+    check(scale_clock(near, 200000 - 1000), "a step within one voltage succeeds");
+    check(near.calls == std::vector<clock_call>{khz_call(200000 - 1000)}, "a step within one voltage only sets the clock");
+}
+
+/// a clock that cannot be set leaves the voltage where it was
+static void test_failed_set_khz() {
+    recording_clock up(BRAINFUCK_CLOCK_NORMAL_KHZ, supported_khz);
+    up.fail_set_khz = true;
+    check(!scale_clock(up, BRAINFUCK_CLOCK_BOOST_KHZ), "a failed speed up is reported");
+    std::vector<clock_call> expected = {
+        voltage_call(voltage_for_khz(BRAINFUCK_CLOCK_BOOST_KHZ)),
+        khz_call(BRAINFUCK_CLOCK_BOOST_KHZ),
+        voltage_call(voltage_for_khz(BRAINFUCK_CLOCK_NORMAL_KHZ))
+    };
+    check(up.calls == expected, "a failed speed up rolls the voltage back");
+    check(up.khz == BRAINFUCK_CLOCK_NORMAL_KHZ && up.voltage == voltage_for_khz(BRAINFUCK_CLOCK_NORMAL_KHZ),
+          "a failed speed up keeps the clock and voltage");
+
+    recording_clock down(BRAINFUCK_CLOCK_BOOST_KHZ, supported_khz);
+    down.fail_set_khz = true;
+    check(!scale_clock(down, BRAINFUCK_CLOCK_NORMAL_KHZ), "a failed slow down is reported");
+    check(down.calls == std::vector<clock_call>{khz_call(BRAINFUCK_CLOCK_NORMAL_KHZ)}, "a failed slow down keeps the voltage");
+}
+
+/// clocks scale_clock refuses before touching anything
+static void test_rejected_khz() {
+    recording_clock clock(BRAINFUCK_CLOCK_NORMAL_KHZ, {0, BRAINFUCK_CLOCK_MAX_KHZ + 1000, 150000 + 1});
+    check(!scale_clock(clock, 0), "0 kHz is rejected");
+    check(!scale_clock(clock, BRAINFUCK_CLOCK_MAX_KHZ + 1000), "a clock above the maximum is rejected");
+    recording_clock unsupported(BRAINFUCK_CLOCK_NORMAL_KHZ, supported_khz);
+    check(!scale_clock(unsupported, 150000 + 1), "a clock the PLL cannot generate is rejected");
+    check(clock.calls.empty() && unsupported.calls.empty(), "rejected clocks touch neither clock nor voltage");
+    check(scale_clock(unsupported, BRAINFUCK_CLOCK_MAX_KHZ), "the maximum clock is accepted");
+}
+
+int main() {
+    test_speed_up();
+    test_slow_down();
+    test_same_voltage();
+    test_failed_set_khz();
+    test_rejected_khz();
+    if (failures) {
+        fprintf(stderr, "%d clock checks failed\n", failures);
+        return 1;
+    }
+    printf("clock checks pass\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+#include "brainfuck_estimate.h"
+
+#pragma mark - tests
+
+/// checks that failed so far
+static int failures = 0;
+
+/**
+ report a failed check
+
+ @param ok   the check
+ @param what what was checked
+*/
+static void check(bool ok, const char * what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ estimate a program
+
+ @param source brainfuck source, balanced
+ @return cost_estimate
+*/
+static cost_estimate estimate(const std::string & source) {
+    return estimate_cost(*compile_bf(source.data(), source.size()));
+}
+
+/**
+ run a program on the compiled engine
+
+ @param source brainfuck source, balanced and without input
+ @return the ops it took
+*/
+static uint64_t ops_of(const std::string & source) {
+    brainfuck_vm_status status;
+    load_program(status, compile_program(source.data(), source.size()));
+    run_compiled(status);
+    return status.instruction_executed;
+}
+
+/**
+ `-[>-[>- ... [-] ... <-]<-]`, loops nested `depth` deep that each run 255 times
+
+ @param depth loops around the innermost `[-]`
+ @return the source
+*/
+static std::string nest(int depth) {
+    std::string source = "-";
+    for (int i = 0; i < depth; i++) source += "[>-";
+    source += "[-]";
+    for (int i = 0; i < depth; i++) source += "<-]";
+    return source;
+}
+
+/**
+ ops of nest(depth) on the compiled engine, counted by hand: the `[-]` on 255 takes
+ 511 ops, and every loop around a body of cost c takes 255 * (c + 5) + 1
+
+ @param depth loops around the innermost `[-]`
+ @return the op count
+*/
+static uint64_t nest_ops(int depth) {
+    uint64_t ops = 2 * 255 + 1;
+    for (int i = 0; i < depth; i++) {
+        ops = 255 * (ops + 5) + 1;
+    }
+    return ops + 1;
+}
+
+/// what the estimator steps through or closes in itself is exact
+static void test_exact() {
+    for (const char * source : {"++++[>+++<-]>.", "++[>++[>+<-]>[<+>-]<<-]", "++++++++[>++++++++[>+<-]<-]"}) {
+        cost_estimate cost = estimate(source);
+        check(cost.exact && !cost.truncated && cost.extrapolated_loops == 0, "a short program is estimated exactly");
+        check(cost.ops == ops_of(source), "an exact estimate counts the ops the compiled engine runs");
+    }
+    check(nest_ops(2) == ops_of(nest(2)), "the hand count of a nest matches the compiled engine");
+}
+
+/// loops too long to sample are projected, and the projection is right for linear loops
+static void test_extrapolated() {
+    cost_estimate cost = estimate(nest(4));
+    check(!cost.exact && !cost.truncated && cost.extrapolated_loops > 0, "a long nest is extrapolated, not truncated");
+    check(cost.ops == nest_ops(4), "the extrapolated nest costs what its loops add up to");
+    check(cost.sampled_ops <= BRAINFUCK_ESTIMATE_SAMPLE_BUDGET, "extrapolating keeps within the sample budget");
+}
+
+/// loops that repeat their state never end
+static void test_diverges() {
+    check(estimate("+[]").diverges, "an empty loop on a non-zero cell diverges");
+    check(estimate("+[>+<]").diverges, "a closed form loop that never moves its counter diverges");
+    check(estimate("+[>[-]<]").diverges, "a sampled loop that leaves its cells as they were diverges");
+    check(!estimate("+[>+<+]").diverges, "a loop that wraps its counter ends");
+}
+
+/// what cannot be sampled or projected within the budget is a lower bound
+static void test_truncated() {
+    cost_estimate cost = estimate(nest(7));
+    check(!cost.exact && cost.truncated, "a nest too deep to project is truncated");
+    check(cost.ops >= BRAINFUCK_ESTIMATE_SAMPLE_BUDGET, "a truncated estimate counts at least the sampled ops");
+}
+
+int main() {
+    test_exact();
+    test_extrapolated();
+    test_diverges();
+    test_truncated();
+    if (failures) {
+        fprintf(stderr, "%d estimate checks failed\n", failures);
+        return 1;
+    }
+    printf("estimate checks pass\n");
+    return 0;
+}
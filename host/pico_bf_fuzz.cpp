@@ -0,0 +1,711 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+#include "brainfuck_image.h"
+#include "brainfuck_cache.h"
+#include "brainfuck_estimate.h"
+#include "brainfuck_pack.h"
+#include "host_pipeline.h"
+#include "host_scan.h"
+#if PICO_BF_HOST_JIT
+#include "host_jit.h"
+#endif
+
+/// longest program decoded from a fuzz input, in ops
+#define PICO_BF_FUZZ_MAX_OPS 4096
+/// compiled ops a case may take, cases running longer are skipped
+#define PICO_BF_FUZZ_FUEL 20000
+/// fuel per slice when checking that a run can be resumed anywhere
+#define PICO_BF_FUZZ_SLICE 7
+/// log2 of the ring tape both engines are compared on, small enough to wrap often
+#define PICO_BF_FUZZ_RING_LOG2 4
+/// threads the parallel scanner splits every case across
+#define PICO_BF_FUZZ_SCAN_THREADS 4
+/// leading words of an image that get a bit flipped each, to try the verifier
+#define PICO_BF_FUZZ_IMAGE_MUTATIONS 48
+/// size of the image cache every case goes through, small so it fills up and starts over often
+#define PICO_BF_FUZZ_CACHE_BYTES 4096
+/// LLVM takes milliseconds to compile a case, only every this many cases is run as machine code
+#define PICO_BF_FUZZ_JIT_EVERY 16
+
+#pragma mark - fuzz io
+
+/// brainfuck_io reading a fixed input and collecting the output
+struct capture_io : brainfuck_io {
+    capture_io(const std::string & input) : input(input) {}
+
+    void put(char c) override {
+        output.push_back(c);
+    }
+
+    int get() override {
+        // end of input reads as 0
+        return pos < input.size() ? static_cast<unsigned char>(input[pos++]) : 0;
+    }
+
+    bool ready() override {
+        // every other `,` has to wait for its input
+        stalled = stutter && !stalled;
+        return !stalled;
+    }
+
+    const std::string & input;
+    size_t pos = 0;
+    std::string output;
+    /// make run_compiled suspend on every other `,`
+    bool stutter = false;
+    bool stalled = false;
+};
+
+#pragma mark - fuzz case
+
+/// a program and its input
+struct fuzz_case {
+    std::string program;
+    std::string input;
+};
+
+/**
+ decode fuzz data into a bracket balanced program and its input,
+ bytes up to the first 0xff are ops, the rest is input
+
+ @param data fuzz data
+ @param size length of data
+ @return fuzz_case
+*/
+fuzz_case decode_case(const uint8_t * data, size_t size) {
+    static const char ops[] = "+-<>[].,";
+    fuzz_case test;
+    int depth = 0;
+    size_t i = 0;
+    for (; i < size && data[i] != 0xff && test.program.size() < PICO_BF_FUZZ_MAX_OPS; i++) {
+        char op = ops[data[i] & 7];
+        if (op == ']' && depth == 0) {
+            // a stray `]` would unbalance the program
+            op = '-';
+        }
+        depth += op == '[' ? 1 : op == ']' ? -1 : 0;
+        test.program.push_back(op);
+    }
+    test.program.append(size_t(depth), ']');
+    if (i < size) {
+        test.input.assign(reinterpret_cast<const char *>(data) + i + 1, size - i - 1);
+    }
+    return test;
+}
+
+/**
+ a random fuzz_case, loops are kept shallow and short so most of them finish
+
+ @param rng random number generator
+ @return fuzz_case
+*/
+fuzz_case random_case(std::mt19937 & rng) {
+    static const char ops[] = "++--<>>.,";
+    fuzz_case test;
+    size_t len = rng() % 64;
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t pick = rng() % 16;
+        if (pick == 0 && depth < 3) {
+            test.program.push_back('[');
+            depth++;
+        } else if (pick == 1 && depth > 0) {
+            test.program.push_back(']');
+            depth--;
+        } else {
+            test.program.push_back(ops[rng() % (sizeof(ops) - 1)]);
+        }
+    }
+    test.program.append(size_t(depth), ']');
+    size_t input_len = rng() % 8;
+    for (size_t i = 0; i < input_len; i++) {
+        test.input.push_back(char(rng()));
+    }
+    return test;
+}
+
+#pragma mark - engine runs
+
+/// everything an engine run is compared on
+struct fuzz_result {
+    bool finished = true;
+    std::string output;
+    int tape_ptr = 0;
+    /// cells [tape_min, tape_min + cells.size())
+    int tape_min = 0;
+    std::vector<char> cells;
+    uint64_t ops = 0;
+};
+
+/**
+ value of a cell without allocating or touching the tape
+
+ @param status the brainfuck vm status
+ @param index  cell index
+ @return the cell
+*/
+char peek_cell(const brainfuck_vm_status & status, int index) {
+    switch (status.mode) {
+        case tape_mode::ring:
+            return status.ring[static_cast<uint32_t>(index) & status.ring_mask];
+        case tape_mode::bounded:
+            if (index < status.bounded_base || index >= status.bounded_base + int(status.bounded.size())) {
+                return 0;
+            }
+            return status.bounded[size_t(index - status.bounded_base)];
+        default: {
+            int page_index = index >> BRAINFUCK_VM_TAPE_PAGE_LOG2;
+            const auto & pages = page_index >= 0 ? status.tape.forward : status.tape.backward;
+            size_t slot = page_index >= 0 ? size_t(page_index) : size_t(~page_index);
+            if (slot >= pages.size() || !pages[slot] || pages[slot]->epoch != status.tape.epoch) {
+                return 0;
+            }
+            return pages[slot]->cells[index & ((1 << BRAINFUCK_VM_TAPE_PAGE_LOG2) - 1)];
+        }
+    }
+}
+
+/**
+ collect the state of a vm after a run
+
+ @param status the brainfuck vm status
+ @param io     io of the run
+ @return fuzz_result
+*/
+fuzz_result collect(const brainfuck_vm_status & status, capture_io & io) {
+    fuzz_result result;
+    result.output = std::move(io.output);
+    result.tape_ptr = status.tape_ptr;
+    result.ops = status.instruction_executed;
+    if (status.mode == tape_mode::ring) {
+        result.cells = status.ring;
+        return result;
+    }
+
+    // every cell the run may have touched, whatever tape backs it
+    const int page_len = 1 << BRAINFUCK_VM_TAPE_PAGE_LOG2;
+    int min = std::min(-int(status.tape.backward.size()) * page_len, status.bounded_base);
+    int max = std::max(int(status.tape.forward.size()) * page_len, status.bounded_base + int(status.bounded.size()));
+    min = std::min(min, status.tape_ptr);
+    max = std::max(max, status.tape_ptr + 1);
+    result.tape_min = min;
+    for (int i = min; i < max; i++) {
+        result.cells.push_back(peek_cell(status, i));
+    }
+    return result;
+}
+
+/**
+ run the program loaded into a vm, in slices of fuel if asked to
+
+ @param status the brainfuck vm status, with a program or an image loaded
+ @param slice  fuel given per resume, 0 runs in one go
+ @param step   run_compiled or run_image
+ @return how the run ended
+*/
+run_result run_in_slices(brainfuck_vm_status & status, uint64_t slice, run_result (*step)(brainfuck_vm_status &)) {
+    run_result result;
+    uint64_t spent = 0;
+    uint64_t fuel = slice ? slice : PICO_BF_FUZZ_FUEL;
+    do {
+        status.fuel = fuel;
+        result = step(status);
+        while (result == run_result::waiting_for_input) {
+            // the input is there by now, the run continues on the fuel it has left
+            result = step(status);
+        }
+        spent += fuel - status.fuel;
+        if (status.fuel == fuel) {
+            // fuel is charged a whole basic block at a time, this one needs a bigger slice
+            fuel *= 2;
+        }
+    } while (result == run_result::out_of_fuel && slice && spent < PICO_BF_FUZZ_FUEL);
+    return result;
+}
+
+/**
+ run a case on the compiled engine
+
+ @param test    the case
+ @param program the compiled program
+ @param tape    how to set up the tape
+ @param slice   fuel given per resume, 0 runs in one go
+ @param stutter suspend on every other `,` and resume straight away
+ @return fuzz_result
+*/
+template <typename Setup>
+fuzz_result run_compiled_case(const fuzz_case & test, const std::shared_ptr<const brainfuck_block> & program, Setup tape, uint64_t slice,
+                              bool stutter = false) {
+    brainfuck_vm_status status;
+    capture_io io(test.input);
+    io.stutter = stutter;
+    status.io = &io;
+    tape(status);
+    load_program(status, program);
+    run_result result = run_in_slices(status, slice, run_compiled);
+
+    fuzz_result collected = collect(status, io);
+    collected.finished = result == run_result::finished;
+    return collected;
+}
+
+/**
+ run a case on the image engine
+
+ @param test    the case
+ @param image   the verified image
+ @param tape    how to set up the tape
+ @param slice   fuel given per resume, 0 runs in one go
+ @param stutter suspend on every other `,` and resume straight away
+ @return fuzz_result
+*/
+template <typename Setup>
+fuzz_result run_image_case(const fuzz_case & test, const std::vector<uint32_t> & image, Setup tape, uint64_t slice,
+                           bool stutter = false) {
+    brainfuck_vm_status status;
+    capture_io io(test.input);
+    io.stutter = stutter;
+    status.io = &io;
+    tape(status);
+    load_image(status, image.data());
+    run_result result = run_in_slices(status, slice, run_image);
+
+    fuzz_result collected = collect(status, io);
+    collected.finished = result == run_result::finished;
+    return collected;
+}
+
+#if PICO_BF_HOST_JIT
+/**
+ run a case as machine code, only for cases known to finish as it has no fuel
+
+ @param test    the case
+ @param program the compiled program
+ @param tape    how to set up the tape, bounded or ring
+ @return fuzz_result
+*/
+template <typename Setup>
+fuzz_result run_jit_case(const fuzz_case & test, const brainfuck_program & program, Setup tape) {
+    brainfuck_vm_status status;
+    capture_io io(test.input);
+    status.io = &io;
+    tape(status);
+    std::string error;
+    std::shared_ptr<const jit_program> jitted = jit_compile(program, status, 2, error);
+    if (!jitted) {
+        fprintf(stderr, "jit_compile fails: %s\nprogram: %s\n", error.c_str(), test.program.c_str());
+        abort();
+    }
+    run_jit(status, *jitted);
+    return collect(status, io);
+}
+#endif
+
+/**
+ run a case through the compile and execute pipeline, cutting after every top-level loop
+
+ @param test the case
+ @return fuzz_result
+*/
+fuzz_result run_pipelined_case(const fuzz_case & test) {
+    brainfuck_vm_status status;
+    capture_io io(test.input);
+    status.io = &io;
+    status.fuel = PICO_BF_FUZZ_FUEL;
+    pipeline_result result = run_pipelined(status, test.program.data(), test.program.size(), 1);
+    fuzz_result collected = collect(status, io);
+    collected.finished = result.result == run_result::finished && result.balanced;
+    return collected;
+}
+
+/**
+ run a case on the reference interpreter
+
+ @param test the case
+ @param tape how to set up the tape
+ @return fuzz_result
+*/
+template <typename Setup>
+fuzz_result run_reference_case(const fuzz_case & test, Setup tape) {
+    brainfuck_vm_status status;
+    capture_io io(test.input);
+    status.io = &io;
+    tape(status);
+    bind_ring_tape(status);
+    for (char op : test.program) {
+        run_vm(status, op);
+    }
+    return collect(status, io);
+}
+
+#pragma mark - comparison
+
+/**
+ print a case and the differing results, then abort so the fuzzer keeps the input
+
+ @param test      the case
+ @param engine    the engine that diverged
+ @param what      what differs
+ @param expected  result of the reference
+ @param actual    result of the engine
+*/
+[[noreturn]] void report_divergence(const fuzz_case & test, const char * engine, const char * what,
+                                    const fuzz_result & expected, const fuzz_result & actual) {
+    fprintf(stderr, "divergence: %s differs on %s\n", engine, what);
+    fprintf(stderr, "program: %s\n", test.program.c_str());
+    fprintf(stderr, "input:");
+    for (char c : test.input) {
+        fprintf(stderr, " %02x", static_cast<unsigned char>(c));
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "reference: ptr=%d, %zu bytes out, %zu cells from %d\n",
+            expected.tape_ptr, expected.output.size(), expected.cells.size(), expected.tape_min);
+    fprintf(stderr, "%s: ptr=%d, %zu bytes out, %zu cells from %d\n",
+            engine, actual.tape_ptr, actual.output.size(), actual.cells.size(), actual.tape_min);
+    abort();
+}
+
+/**
+ compare two runs on output, pointer and every cell either of them may have touched
+
+ @param test     the case
+ @param engine   name of the engine under test
+ @param expected result of the reference
+ @param actual   result of the engine
+*/
+void compare(const fuzz_case & test, const char * engine, const fuzz_result & expected, const fuzz_result & actual) {
+    if (!actual.finished) {
+        report_divergence(test, engine, "termination", expected, actual);
+    }
+    if (expected.output != actual.output) {
+        report_divergence(test, engine, "output", expected, actual);
+    }
+    if (expected.tape_ptr != actual.tape_ptr) {
+        report_divergence(test, engine, "pointer", expected, actual);
+    }
+    int min = std::min(expected.tape_min, actual.tape_min);
+    int max = std::max(expected.tape_min + int(expected.cells.size()), actual.tape_min + int(actual.cells.size()));
+    for (int i = min; i < max; i++) {
+        auto cell = [i](const fuzz_result & result) -> char {
+            int offset = i - result.tape_min;
+            return offset >= 0 && offset < int(result.cells.size()) ? result.cells[size_t(offset)] : 0;
+        };
+        if (cell(expected) != cell(actual)) {
+            report_divergence(test, engine, "tape", expected, actual);
+        }
+    }
+}
+
+/**
+ flip a bit in each of the first words of an image, every mutant the verifier lets through
+ must run on the bounded tape its header asks for without leaving it
+
+ @param test  the case
+ @param image a verified image
+*/
+void check_image_mutations(const fuzz_case & test, const std::vector<uint32_t> & image) {
+    for (size_t i = 0; i < std::min<size_t>(image.size(), PICO_BF_FUZZ_IMAGE_MUTATIONS); i++) {
+        std::vector<uint32_t> mutant = image;
+        mutant[i] ^= 1u << (i * 7 % 32);
+        if (verify_image(mutant.data(), mutant.size() * sizeof(uint32_t))) {
+            continue;
+        }
+        // only a bounded tape trusts the image, an unbounded pointer may drift anywhere as on any engine
+        tape_extent extent = image_extent(mutant.data());
+        brainfuck_vm_status status;
+        if (!size_tape_for(status, extent)) {
+            continue;
+        }
+        capture_io io(test.input);
+        status.io = &io;
+        load_image(status, mutant.data());
+        status.fuel = PICO_BF_FUZZ_FUEL;
+        run_image(status);
+        if (status.tape_ptr < extent.min || status.tape_ptr > extent.max) {
+            fprintf(stderr, "verify_image let word %zu through, the pointer left the tape\nprogram: %s\n",
+                    i, test.program.c_str());
+            abort();
+        }
+    }
+}
+
+/// cache_storage in RAM that programs like NOR flash, bits only ever go from 1 to 0
+struct ram_storage : cache_storage {
+    const uint8_t * data() const override {
+        return bytes.data();
+    }
+
+    size_t size() const override {
+        return bytes.size();
+    }
+
+    void erase() override {
+        std::fill(bytes.begin(), bytes.end(), 0xff);
+    }
+
+    void program(size_t offset, const uint8_t * from, size_t len) override {
+        for (size_t i = 0; i < len; i++) {
+            bytes[offset + i] &= from[i];
+        }
+    }
+
+    std::vector<uint8_t> bytes = std::vector<uint8_t>(PICO_BF_FUZZ_CACHE_BYTES, 0xff);
+};
+
+/**
+ store an image in a cache shared by every case and look it up again, as this build and as another one
+
+ @param test  the case
+ @param image its image
+*/
+void check_cache(const fuzz_case & test, const std::vector<uint32_t> & image) {
+    static ram_storage storage;
+    static image_cache cache(storage, 1);
+    uint32_t ops;
+    uint64_t key = key_source(test.program.data(), test.program.size(), ops);
+    if (!cache.store(key, image)) {
+        // larger than the whole cache
+        return;
+    }
+    size_t len = 0;
+    const void * found = cache.find(key, len);
+    const char * error = nullptr;
+    if (!found || len != image.size() * sizeof(uint32_t) || memcmp(found, image.data(), len) != 0) {
+        error = "the image stored is not found";
+    } else if (image_cache(storage, 2).find(key, len)) {
+        error = "another build finds the image";
+    }
+    if (error) {
+        fprintf(stderr, "cache: %s\nprogram: %s\n", error, test.program.c_str());
+        abort();
+    }
+}
+
+/**
+ run a case through the reference and every optimised engine
+
+ @param test the case
+*/
+void check_case(const fuzz_case & test) {
+    std::optional<brainfuck_block> compiled = compile_bf(test.program.data(), test.program.size());
+    if (!compiled) {
+        fprintf(stderr, "decoded an unbalanced program: %s\n", test.program.c_str());
+        abort();
+    }
+    auto program = std::make_shared<const brainfuck_block>(std::move(*compiled));
+
+    auto infinite = [](brainfuck_vm_status & status) { use_infinite_tape(status); };
+    auto ring = [](brainfuck_vm_status & status) { use_ring_tape(status, PICO_BF_FUZZ_RING_LOG2); };
+
+    // the reference has no fuel, only cases the compiled engine finishes are compared
+    fuzz_result compiled_run = run_compiled_case(test, program, infinite, 0);
+    if (!compiled_run.finished) {
+        return;
+    }
+    fuzz_result reference = run_reference_case(test, infinite);
+    compare(test, "compiled", reference, compiled_run);
+
+    fuzz_result resumed = run_compiled_case(test, program, infinite, PICO_BF_FUZZ_SLICE);
+    compare(test, "compiled, resumed", reference, resumed);
+    if (resumed.ops != compiled_run.ops) {
+        report_divergence(test, "compiled, resumed", "op count", compiled_run, resumed);
+    }
+
+    fuzz_result stuttered = run_compiled_case(test, program, infinite, PICO_BF_FUZZ_SLICE, true);
+    compare(test, "compiled, suspended on input", reference, stuttered);
+    if (stuttered.ops != compiled_run.ops) {
+        report_divergence(test, "compiled, suspended on input", "op count", compiled_run, stuttered);
+    }
+
+    // the image is the same program flattened, it counts the same ops
+    std::vector<uint32_t> image = build_image(*make_program(*program));
+    if (const char * error = verify_image(image.data(), image.size() * sizeof(uint32_t))) {
+        fprintf(stderr, "verify_image rejects a built image: %s\nprogram: %s\n", error, test.program.c_str());
+        abort();
+    }
+    fuzz_result imaged = run_image_case(test, image, infinite, 0);
+    compare(test, "image", reference, imaged);
+    if (imaged.ops != compiled_run.ops) {
+        report_divergence(test, "image", "op count", compiled_run, imaged);
+    }
+    fuzz_result imaged_resumed = run_image_case(test, image, infinite, PICO_BF_FUZZ_SLICE, true);
+    compare(test, "image, resumed and suspended on input", reference, imaged_resumed);
+    if (imaged_resumed.ops != compiled_run.ops) {
+        report_divergence(test, "image, resumed and suspended on input", "op count", compiled_run, imaged_resumed);
+    }
+    if (image_extent(image.data()).bounded) {
+        auto bounded = [&image](brainfuck_vm_status & status) { size_tape_for(status, image_extent(image.data())); };
+        compare(test, "image, bounded tape", reference, run_image_case(test, image, bounded, 0));
+    }
+    check_image_mutations(test, image);
+    check_cache(test, image);
+
+    fuzz_result pipelined = run_pipelined_case(test);
+    compare(test, "pipelined", reference, pipelined);
+    if (!pipelined.finished || pipelined.ops != compiled_run.ops) {
+        report_divergence(test, "pipelined", "op count", compiled_run, pipelined);
+    }
+
+#if PICO_BF_HOST_JIT
+    static unsigned long cases = 0;
+    bool jit = cases++ % PICO_BF_FUZZ_JIT_EVERY == 0;
+    auto shared = jit ? make_program(*program) : nullptr;
+#endif
+    brainfuck_vm_status sized;
+    if (size_tape_for(sized, *program)) {
+        auto bounded = [&program](brainfuck_vm_status & status) { size_tape_for(status, *program); };
+        compare(test, "compiled, bounded tape", reference, run_compiled_case(test, program, bounded, 0));
+#if PICO_BF_HOST_JIT
+        if (jit) {
+            fuzz_result jitted = run_jit_case(test, *shared, bounded);
+            compare(test, "jit, bounded tape", reference, jitted);
+            if (jitted.ops != compiled_run.ops) {
+                report_divergence(test, "jit, bounded tape", "op count", compiled_run, jitted);
+            }
+        }
+#endif
+    }
+
+    // wrapping around may keep a loop from ever finding its zero
+    fuzz_result ring_run = run_compiled_case(test, program, ring, 0);
+    if (ring_run.finished) {
+        fuzz_result ring_reference = run_reference_case(test, ring);
+        compare(test, "compiled, ring tape", ring_reference, ring_run);
+#if PICO_BF_HOST_JIT
+        if (jit) {
+            compare(test, "jit, ring tape", ring_reference, run_jit_case(test, *shared, ring));
+        }
+#endif
+    }
+
+    // the estimator promises the exact op count of the compiled engine, as long as it knows the input
+    cost_estimate estimate = estimate_cost(*program);
+    if (!estimate.reads_input && (estimate.diverges || (estimate.exact && estimate.ops != compiled_run.ops))) {
+        fuzz_result predicted = compiled_run;
+        predicted.ops = estimate.ops;
+        fprintf(stderr, "estimate: %llu ops, ran %llu\n",
+                (unsigned long long)estimate.ops, (unsigned long long)compiled_run.ops);
+        report_divergence(test, "estimate", "op count", compiled_run, predicted);
+    }
+}
+
+/**
+ scan raw source on several threads, in chunks of a few bytes, and abort unless
+ it agrees with the sequential scan and with the compiler on the brackets
+
+ @param source brainfuck source, comments and unbalanced brackets welcome
+ @param len    length of source
+*/
+void check_scan(const char * source, size_t len) {
+    scanned_source expected = scan_bf_sequential(source, len);
+    scanned_source actual = scan_bf(source, len, PICO_BF_FUZZ_SCAN_THREADS, 1);
+    const char * field = nullptr;
+    if (actual.ops != expected.ops) {
+        field = "ops";
+    } else if (actual.balanced != expected.balanced || actual.first_unmatched != expected.first_unmatched) {
+        field = "balance";
+    } else if (expected.balanced != compile_bf(source, len).has_value()) {
+        field = "balance against compile_bf";
+    }
+    if (field) {
+        fprintf(stderr, "scan: %s differs\nsource: %.*s\n", field, int(len), source);
+        abort();
+    }
+}
+
+/**
+ pack raw source and abort unless unpacking it gives back its commands
+
+ @param source brainfuck source, comments welcome
+ @param len    length of source
+*/
+void check_pack(const char * source, size_t len) {
+    std::string expected;
+    for (size_t i = 0; i < len; i++) {
+        if (source[i] != '\0' && strchr("+-><.,[]", source[i])) {
+            expected.push_back(source[i]);
+        }
+    }
+    std::vector<uint8_t> packed = pack_bf(source, len);
+    bf_unpacker unpacker(packed.data(), packed.size());
+    std::string unpacked;
+    for (int c; (c = unpacker.next()) != -1;) {
+        unpacked.push_back(char(c));
+    }
+    if (!unpacker.valid || unpacker.ops != expected.size() || unpacked != expected) {
+        fprintf(stderr, "pack: round trip differs\nsource: %.*s\n", int(len), source);
+        abort();
+    }
+}
+
+#pragma mark - entry points
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    check_scan(reinterpret_cast<const char *>(data), size);
+    check_pack(reinterpret_cast<const char *>(data), size);
+    check_case(decode_case(data, size));
+    return 0;
+}
+
+#ifndef PICO_BF_LIBFUZZER
+/**
+ read a whole stream
+
+ @param file the stream
+ @return its bytes
+*/
+std::vector<uint8_t> read_stream(FILE * file) {
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    return data;
+}
+
+/// without libFuzzer: run files (or stdin, for AFL) as fuzz inputs, or `--random N [seed]` generated cases
+int main(int argc, char ** argv) {
+    if (argc >= 3 && strcmp(argv[1], "--random") == 0) {
+        unsigned long count = strtoul(argv[2], nullptr, 10);
+        std::mt19937 rng(argc >= 4 ? uint32_t(strtoul(argv[3], nullptr, 10)) : 1);
+        for (unsigned long i = 0; i < count; i++) {
+            fuzz_case test = random_case(rng);
+            check_case(test);
+            // a stray bracket or comment somewhere for the scanner
+            std::string source = test.program;
+            source.insert(rng() % (source.size() + 1), 1, "[]#"[rng() % 3]);
+            check_scan(source.data(), source.size());
+            check_pack(source.data(), source.size());
+        }
+        printf("%lu random cases agree\n", count);
+        return 0;
+    }
+
+    if (argc == 1) {
+        std::vector<uint8_t> data = read_stream(stdin);
+        return LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    for (int i = 1; i < argc; i++) {
+        FILE * file = fopen(argv[i], "rb");
+        if (!file) {
+            perror(argv[i]);
+            return 1;
+        }
+        std::vector<uint8_t> data = read_stream(file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+#include "brainfuck_image.h"
+#include "host_io.h"
+#include "host_pipeline.h"
+#include "host_scan.h"
+#if PICO_BF_HOST_JIT
+#include "host_jit.h"
+#endif
+
+/// exit status when the program cannot be read or run
+#define PICO_BF_HOST_EXIT_ERROR 1
+/// exit status when the program has unbalanced brackets
+#define PICO_BF_HOST_EXIT_UNBALANCED 2
+/// exit status when the program ran out of fuel
+#define PICO_BF_HOST_EXIT_OUT_OF_FUEL 3
+
+#pragma mark - options
+
+/// tape requested on the command line
+enum class host_tape {
+    /// bounded when static analysis can size the tape, infinite otherwise
+    automatic,
+    infinite,
+    ring,
+    bounded
+};
+
+/// which engine runs the program
+enum class host_engine {
+    compiled,
+    reference,
+    /// the program flattened into a bytecode image, or an image file from pico_bf_pack
+    image,
+    /// the program compiled to machine code by LLVM, builds with LLVM only
+    jit
+};
+
+/// command line options
+struct host_options {
+    const char * program_path = nullptr;
+    /// more than one runs the program once per input, with -d
+    std::vector<const char *> input_paths;
+    const char * output_path = nullptr;
+    host_tape tape = host_tape::automatic;
+    unsigned ring_log2 = BRAINFUCK_VM_RING_TAPE_LOG2;
+    host_engine engine = host_engine::compiled;
+    /// value `,` stores once the input is exhausted, cells are 8 bits wide
+    int eof = 0;
+    uint64_t fuel = UINT64_MAX;
+    bool stats = false;
+    /// print a digest of the output instead of the output
+    bool digest = false;
+    /// compile and run in segments at the same time
+    bool pipeline = false;
+    /// LLVM optimisation level of the jit engine
+    unsigned jit_opt = 3;
+};
+
+/**
+ print usage to stderr
+
+ @param name argv[0]
+*/
+void usage(const char * name) {
+    fprintf(stderr,
+            "usage: %s [options] program.bf\n"
+            "  -i, --input FILE      program input, mapped into memory (default: stdin unless it is a terminal),\n"
+            "                        repeat it with -d to run the program compiled once on every input, one per core\n"
+            "  -o, --output FILE     program output (default: stdout)\n"
+            "  -t, --tape MODE       auto, infinite, ring or bounded (default: auto)\n"
+            "      --ring-log2 N     log2 of the ring tape length, 1 to 31 (default: %d)\n"
+            "  -e, --engine ENGINE   compiled, reference, image or jit (default: compiled), image also runs\n"
+            "                        an image file from pico_bf_pack --image as it is, after verifying it,\n"
+            "                        jit needs a build with LLVM and falls back to compiled without fuel or a flat tape\n"
+            "      --jit-opt N       LLVM optimisation level of the jit engine, 2 or 3 (default: 3)\n"
+            "      --eof N           value a cell reads past the end of input, 0 to 255 or -1 for 255 (default: 0)\n"
+            "      --fuel OPS        stop after this many compiled ops (compiled and image engines)\n"
+            "  -d, --digest          print the FNV-1a digest and length of the output instead of the output\n"
+            "  -p, --pipeline        compile and run segments concurrently, the program starts before it is all compiled\n"
+            "                        (compiled engine, auto means infinite, brackets are checked as segments arrive)\n"
+            "  -s, --stats           report ops and wall time to stderr\n",
+            name, BRAINFUCK_VM_RING_TAPE_LOG2);
+}
+
+/**
+ parse an option argument as a decimal number, strtoull alone reads anything else as 0
+
+ @param text  the argument
+ @param value set to the number
+ @return whether all of `text` is a decimal number that fits in 64 bits
+*/
+bool parse_number(const char * text, uint64_t & value) {
+    if (*text < '0' || *text > '9') {
+        return false;
+    }
+    char * end;
+    errno = 0;
+    value = strtoull(text, &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
+
+/**
+ parse the command line
+
+ @param argc    argc of main
+ @param argv    argv of main
+ @param options parsed options
+ @return whether the command line is valid
+*/
+bool parse_options(int argc, char ** argv, host_options & options) {
+    enum { opt_ring_log2 = 256, opt_eof, opt_fuel, opt_jit_opt };
+    static const struct option long_options[] = {
+        {"input", required_argument, nullptr, 'i'},
+        {"output", required_argument, nullptr, 'o'},
+        {"tape", required_argument, nullptr, 't'},
+        {"ring-log2", required_argument, nullptr, opt_ring_log2},
+        {"engine", required_argument, nullptr, 'e'},
+        {"eof", required_argument, nullptr, opt_eof},
+        {"fuel", required_argument, nullptr, opt_fuel},
+        {"jit-opt", required_argument, nullptr, opt_jit_opt},
+        {"digest", no_argument, nullptr, 'd'},
+        {"pipeline", no_argument, nullptr, 'p'},
+        {"stats", no_argument, nullptr, 's'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    uint64_t number;
+    while ((opt = getopt_long(argc, argv, "i:o:t:e:dps", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                options.input_paths.push_back(optarg);
+                break;
+            case 'o':
+                options.output_path = optarg;
+                break;
+            case 't':
+                if (strcmp(optarg, "auto") == 0) {
+                    options.tape = host_tape::automatic;
+                } else if (strcmp(optarg, "infinite") == 0) {
+                    options.tape = host_tape::infinite;
+                } else if (strcmp(optarg, "ring") == 0) {
+                    options.tape = host_tape::ring;
+                } else if (strcmp(optarg, "bounded") == 0) {
+                    options.tape = host_tape::bounded;
+                } else {
+                    return false;
+                }
+                break;
+            case opt_ring_log2:
+                if (!parse_number(optarg, number) || number < 1 || number > 31) {
+                    return false;
+                }
+                options.ring_log2 = unsigned(number);
+                break;
+            case 'e':
+                if (strcmp(optarg, "compiled") == 0) {
+                    options.engine = host_engine::compiled;
+                } else if (strcmp(optarg, "reference") == 0) {
+                    options.engine = host_engine::reference;
+                } else if (strcmp(optarg, "image") == 0) {
+                    options.engine = host_engine::image;
+#if PICO_BF_HOST_JIT
+                } else if (strcmp(optarg, "jit") == 0) {
+                    options.engine = host_engine::jit;
+#endif
+                } else {
+                    return false;
+                }
+                break;
+            case opt_eof:
+                if (strcmp(optarg, "-1") == 0) {
+                    number = 255;
+                } else if (!parse_number(optarg, number) || number > 255) {
+                    return false;
+                }
+                options.eof = int(number);
+                break;
+            case opt_fuel:
+                if (!parse_number(optarg, options.fuel)) {
+                    return false;
+                }
+                break;
+            case opt_jit_opt:
+                if (!parse_number(optarg, number) || number < 2 || number > 3) {
+                    return false;
+                }
+                options.jit_opt = unsigned(number);
+                break;
+            case 'd':
+                options.digest = true;
+                break;
+            case 'p':
+                options.pipeline = true;
+                break;
+            case 's':
+                options.stats = true;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        return false;
+    }
+    if (options.pipeline && (options.engine != host_engine::compiled || options.tape == host_tape::bounded)) {
+        // neither works on a program that is not fully compiled yet
+        return false;
+    }
+    if (options.input_paths.size() > 1 && (!options.digest || options.pipeline || options.engine != host_engine::compiled)) {
+        // the digests of several outputs can be told apart, the outputs themselves cannot
+        return false;
+    }
+    options.program_path = argv[optind];
+    return true;
+}
+
+#pragma mark - running
+
+/**
+ set up the tape of a vm
+
+ @param status  the brainfuck vm status
+ @param tape    the tape asked for
+ @param options command line options
+ @param extent  cells the program reaches, null in a pipeline
+ @return false if the tape cannot be bounded as asked
+*/
+bool prepare_tape(brainfuck_vm_status & status, host_tape tape, const host_options & options, const tape_extent * extent) {
+    switch (tape) {
+        case host_tape::ring:
+            use_ring_tape(status, options.ring_log2);
+            break;
+        case host_tape::bounded:
+            return size_tape_for(status, *extent);
+        case host_tape::automatic:
+            size_tape_for(status, *extent);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/// outcome of one of the runs of run_inputs
+struct input_run {
+    uint64_t digest = 0;
+    uint64_t written = 0;
+    uint64_t ops = 0;
+    run_result result = run_result::finished;
+    /// the input could not be read
+    bool failed = false;
+};
+
+/**
+ run a program on every input, each in a context of its own, and print the digest of
+ every output in input order
+
+ the program is compiled once and shared, a context is only a tape and a few registers,
+ so every core takes the next input until none is left
+
+ @param options   command line options
+ @param program   the compiled program
+ @param output_fd where the digests go
+ @return exit status
+*/
+int run_inputs(const host_options & options, const std::shared_ptr<const brainfuck_program> & program, int output_fd) {
+    std::vector<input_run> runs(options.input_paths.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next++; i < runs.size(); i = next++) {
+            input_run & run = runs[i];
+            mapped_file file;
+            std::vector<char> data;
+            const char * input = nullptr;
+            size_t len = 0;
+            if (!load_file(options.input_paths[i], file, data, input, len)) {
+                run.failed = true;
+                continue;
+            }
+            brainfuck_vm_status status;
+            if (!prepare_tape(status, options.tape, options, &program->extent)) {
+                run.failed = true;
+                continue;
+            }
+            buffered_io io(input, len, -1, options.eof);
+            digest_io digest(&io);
+            status.io = &digest;
+            status.fuel = options.fuel;
+            load_program(status, program);
+            run.result = run_compiled(status);
+            run.digest = digest.digest;
+            run.written = digest.written;
+            run.ops = status.instruction_executed;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), runs.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & thread : workers) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    buffered_io out(nullptr, 0, output_fd, options.eof);
+    int status = 0;
+    uint64_t ops = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+        const input_run & run = runs[i];
+        if (run.failed) {
+            status = PICO_BF_HOST_EXIT_ERROR;
+            continue;
+        }
+        if (run.result == run_result::out_of_fuel) {
+            fprintf(stderr, "%s: out of fuel after %llu ops\n", options.input_paths[i], (unsigned long long)run.ops);
+            status = std::max(status, PICO_BF_HOST_EXIT_OUT_OF_FUEL);
+            continue;
+        }
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%016llx %llu ", (unsigned long long)run.digest, (unsigned long long)run.written);
+        for (int j = 0; j < len; j++) {
+            out.put(line[j]);
+        }
+        for (const char * c = options.input_paths[i]; *c; c++) {
+            out.put(*c);
+        }
+        out.put('\n');
+        ops += run.ops;
+    }
+    out.flush();
+    if (options.stats) {
+        fprintf(stderr, "%lu inputs on %lu threads, %llu ops, %.3f s, %.0f ops/s\n",
+                (unsigned long)runs.size(), (unsigned long)threads, (unsigned long long)ops, elapsed,
+                elapsed > 0 ? double(ops) / elapsed : 0.0);
+    }
+    if (out.failed) {
+        fprintf(stderr, "output: %s\n", strerror(errno));
+        return PICO_BF_HOST_EXIT_ERROR;
+    }
+    return status;
+}
+
+#pragma mark - main
+
+int main(int argc, char ** argv) {
+    host_options options;
+    if (!parse_options(argc, argv, options)) {
+        usage(argv[0]);
+        return PICO_BF_HOST_EXIT_ERROR;
+    }
+
+    mapped_file program_file;
+    std::vector<char> program_data;
+    const char * source = nullptr;
+    size_t source_len = 0;
+    if (!load_file(options.program_path, program_file, program_data, source, source_len)) {
+        return PICO_BF_HOST_EXIT_ERROR;
+    }
+
+    // without --input, the program reads whatever stdin holds, a terminal gives no input
+    mapped_file input_file;
+    std::vector<char> input_data;
+    const char * input = nullptr;
+    size_t input_len = 0;
+    if (options.input_paths.size() == 1) {
+        if (!load_file(options.input_paths[0], input_file, input_data, input, input_len)) {
+            return PICO_BF_HOST_EXIT_ERROR;
+        }
+    } else if (!isatty(STDIN_FILENO)) {
+        if (!map_or_read(STDIN_FILENO, input_file, input_data, input, input_len)) {
+            fprintf(stderr, "stdin: %s\n", strerror(errno));
+            return PICO_BF_HOST_EXIT_ERROR;
+        }
+    }
+
+    int output_fd = STDOUT_FILENO;
+    if (options.output_path) {
+        output_fd = open(options.output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output_fd < 0) {
+            fprintf(stderr, "%s: %s\n", options.output_path, strerror(errno));
+            return PICO_BF_HOST_EXIT_ERROR;
+        }
+    }
+
+    // an image file is run as it is, nothing is scanned or compiled
+    bool prebuilt = options.engine == host_engine::image && source_len >= sizeof(uint32_t) &&
+                    memcmp(source, BRAINFUCK_IMAGE_MAGIC, 3) == 0;
+
+    // the pipeline scans and compiles while it runs, otherwise it all happens upfront:
+    // brackets are checked on every core before anything is compiled
+    auto scan_start = std::chrono::steady_clock::now();
+    scanned_source scanned;
+    if (!options.pipeline && !prebuilt) {
+        scanned = scan_bf(source, source_len);
+        if (!scanned.balanced) {
+            fprintf(stderr, "%s: unbalanced bracket at instruction %lu\n",
+                    options.program_path, (unsigned long)scanned.first_unmatched);
+            return PICO_BF_HOST_EXIT_UNBALANCED;
+        }
+    }
+
+    // compiled for both engines, it sizes the tape
+    auto compile_start = std::chrono::steady_clock::now();
+    std::shared_ptr<const brainfuck_program> program;
+    if (!options.pipeline && !prebuilt) {
+        program = compile_program(scanned.ops.data(), scanned.ops.size());
+        if (!program) {
+            fprintf(stderr, "%s: unbalanced brackets\n", options.program_path);
+            return PICO_BF_HOST_EXIT_UNBALANCED;
+        }
+    }
+    std::vector<uint32_t> built;
+    const void * image = nullptr;
+    size_t image_len = 0;
+    if (options.engine == host_engine::image) {
+        const char * error = nullptr;
+        if (prebuilt) {
+            image = source;
+            image_len = source_len;
+            error = verify_image(image, image_len);
+        } else {
+            built = build_image(*program);
+            image = built.data();
+            image_len = built.size() * sizeof(uint32_t);
+            error = built.empty() ? "too large for an image" : nullptr;
+        }
+        if (error) {
+            fprintf(stderr, "%s: %s\n", options.program_path, error);
+            return PICO_BF_HOST_EXIT_ERROR;
+        }
+    }
+    auto compile_end = std::chrono::steady_clock::now();
+
+    // the pipeline has no whole program to size the tape for
+    host_tape tape = options.pipeline && options.tape == host_tape::automatic ? host_tape::infinite : options.tape;
+    tape_extent extent = image ? image_extent(image) : program ? program->extent : tape_extent();
+    brainfuck_vm_status status;
+    if (!prepare_tape(status, tape, options, options.pipeline ? nullptr : &extent)) {
+        fprintf(stderr, "%s: the tape cannot be bounded statically\n", options.program_path);
+        return PICO_BF_HOST_EXIT_ERROR;
+    }
+#if PICO_BF_HOST_JIT
+    // machine code runs to the end on flat cells, anything else stays on the compiled engine
+    std::shared_ptr<const jit_program> jitted;
+    double jit_seconds = 0;
+    if (options.engine == host_engine::jit) {
+        auto jit_start = std::chrono::steady_clock::now();
+        std::string error;
+        if (options.fuel != UINT64_MAX) {
+            error = "machine code does not count fuel";
+        } else {
+            jitted = jit_compile(*program, status, options.jit_opt, error);
+        }
+        jit_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jit_start).count();
+        if (!jitted) {
+            fprintf(stderr, "%s: %s, running on the compiled engine\n", options.program_path, error.c_str());
+        }
+    }
+#endif
+    if (options.input_paths.size() > 1) {
+        return run_inputs(options, program, output_fd);
+    }
+
+    buffered_io io(input, input_len, output_fd, options.eof);
+    digest_io digest(&io);
+    status.io = options.digest ? static_cast<brainfuck_io *>(&digest) : &io;
+
+    run_result result = run_result::finished;
+    pipeline_result pipelined;
+    auto start = std::chrono::steady_clock::now();
+    if (options.pipeline) {
+        status.fuel = options.fuel;
+        pipelined = run_pipelined(status, source, source_len);
+        result = pipelined.result;
+    } else if (options.engine == host_engine::reference) {
+        program.reset();
+        bind_ring_tape(status);
+        for (char c : scanned.ops) {
+            run_vm(status, c);
+        }
+    } else if (options.engine == host_engine::image) {
+        program.reset();
+        load_image(status, image);
+        status.fuel = options.fuel;
+        result = run_image(status);
+#if PICO_BF_HOST_JIT
+    } else if (jitted) {
+        run_jit(status, *jitted);
+#endif
+    } else {
+        load_program(status, program);
+        status.fuel = options.fuel;
+        result = run_compiled(status);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.digest) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%016llx %llu\n", (unsigned long long)digest.digest, (unsigned long long)digest.written);
+        for (int i = 0; i < len; i++) {
+            io.put(line[i]);
+        }
+    }
+    io.flush();
+    if (options.stats) {
+        if (options.pipeline) {
+            fprintf(stderr, "%lu segments compiled while running\n", (unsigned long)pipelined.segments);
+        } else if (prebuilt) {
+            fprintf(stderr, "%lu image words, verify %.3f s\n", (unsigned long)(image_len / sizeof(uint32_t)),
+                    std::chrono::duration<double>(compile_end - compile_start).count());
+        } else {
+            fprintf(stderr, "%lu instructions, scan %.3f s, compile %.3f s\n", (unsigned long)scanned.ops.size(),
+                    std::chrono::duration<double>(compile_start - scan_start).count(),
+                    std::chrono::duration<double>(compile_end - compile_start).count());
+        }
+#if PICO_BF_HOST_JIT
+        if (jitted) {
+            fprintf(stderr, "jit -O%u %.3f s\n", options.jit_opt, jit_seconds);
+        }
+#endif
+        fprintf(stderr, "%llu ops, %llu bytes out, %.3f s, %.0f ops/s\n",
+                (unsigned long long)status.instruction_executed,
+                (unsigned long long)(options.digest ? digest.written : io.written()), elapsed,
+                elapsed > 0 ? double(status.instruction_executed) / elapsed : 0.0);
+    }
+    if (io.failed) {
+        fprintf(stderr, "output: %s\n", strerror(errno));
+        return PICO_BF_HOST_EXIT_ERROR;
+    }
+    if (result == run_result::out_of_fuel) {
+        fprintf(stderr, "out of fuel after %llu ops\n", (unsigned long long)status.instruction_executed);
+        return PICO_BF_HOST_EXIT_OUT_OF_FUEL;
+    }
+    if (!pipelined.balanced) {
+        fprintf(stderr, "%s: unbalanced brackets, stopped after %lu segments\n",
+                options.program_path, (unsigned long)pipelined.segments);
+        return PICO_BF_HOST_EXIT_UNBALANCED;
+    }
+    return 0;
+}
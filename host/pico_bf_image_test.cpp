@@ -0,0 +1,103 @@
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "brainfuck_vm.h"
+#include "brainfuck_ir.h"
+#include "brainfuck_image.h"
+
+/// header words holding the flags and the extent, as laid out by build_image
+#define IMAGE_TEST_FLAGS 2
+#define IMAGE_TEST_EXTENT_MIN 3
+#define IMAGE_TEST_EXTENT_MAX 4
+
+#pragma mark - tests
+
+/// checks that failed so far
+static int failures = 0;
+
+/**
+ report a failed check
+
+ @param ok   the check
+ @param what what was checked
+*/
+static void check(bool ok, const char * what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ build the image of a program
+
+ @param source brainfuck source, balanced
+ @return the image
+*/
+static std::vector<uint32_t> image_of(const char * source) {
+    return build_image(*compile_program(source, strlen(source)));
+}
+
+/**
+ verify an image
+
+ @param image the image
+ @return whether verify_image accepts it
+*/
+static bool verifies(const std::vector<uint32_t> & image) {
+    return verify_image(image.data(), image.size() * sizeof(uint32_t)) == nullptr;
+}
+
+/// images built from programs verify, with the extent their pointer reaches
+static void test_built_images() {
+    std::vector<uint32_t> image = image_of("++[>+>++<<-]>>.");
+    check(verifies(image), "a built image verifies");
+    tape_extent extent = image_extent(image.data());
+    check(extent.bounded && extent.min == 0 && extent.max == 2, "a built image keeps the extent of its program");
+
+    std::vector<uint32_t> drifting = image_of("+[>+]");
+    check(verifies(drifting) && !image_extent(drifting.data()).bounded, "a drifting loop is not bounded");
+
+    // longer than a bounded tape may be, it runs on the user's tape instead
+    std::string far(BRAINFUCK_VM_TAPE_LEN + 10, '>');
+    std::vector<uint32_t> wide = image_of((far + "+").c_str());
+    check(verifies(wide) && !image_extent(wide.data()).bounded, "an extent too long for a bounded tape is not bounded");
+}
+
+/// a bounded header must hold an extent that size_tape_for can allocate
+static void test_header_extent() {
+    std::vector<uint32_t> image = image_of("++[>+<-]>.");
+    auto with_extent = [&image](int min, int max) {
+        std::vector<uint32_t> mutant = image;
+        mutant[IMAGE_TEST_FLAGS] = BRAINFUCK_IMAGE_BOUNDED;
+        mutant[IMAGE_TEST_EXTENT_MIN] = uint32_t(min);
+        mutant[IMAGE_TEST_EXTENT_MAX] = uint32_t(max);
+        return mutant;
+    };
+    check(verifies(with_extent(-5, 5)), "a wider extent than needed is accepted");
+    check(!verifies(with_extent(INT_MIN, INT_MAX)), "an extent spanning every int is rejected");
+    check(!verifies(with_extent(5, 0)), "an extent with max below min is rejected");
+    check(!verifies(with_extent(0, BRAINFUCK_VM_TAPE_LEN)), "an extent one cell too long is rejected");
+    check(verifies(with_extent(0, BRAINFUCK_VM_TAPE_LEN - 1)), "an extent of a whole tape is accepted");
+    check(!verifies(with_extent(1, 5)), "an extent missing a reachable cell is rejected");
+
+    brainfuck_vm_status status;
+    tape_extent huge;
+    huge.min = INT_MIN;
+    huge.max = INT_MAX;
+    check(!size_tape_for(status, huge), "size_tape_for refuses an extent spanning every int");
+}
+
+int main() {
+    test_built_images();
+    test_header_extent();
+    if (failures) {
+        fprintf(stderr, "%d image checks failed\n", failures);
+        return 1;
+    }
+    printf("image checks pass\n");
+    return 0;
+}
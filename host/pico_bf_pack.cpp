@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "brainfuck_image.h"
+#include "brainfuck_pack.h"
+#include "host_io.h"
+
+/**
+ print usage to stderr
+
+ @param name argv[0]
+*/
+void usage(const char * name) {
+    fprintf(stderr,
+            "usage: %s program.bf header.h name\n"
+            "  packs program.bf and writes it to header.h as `static const uint8_t <name>_packed[]`\n"
+            "       %s --image program.bf header.h name\n"
+            "  compiles program.bf into an image and writes it to header.h as `static const uint32_t <name>_image[]`\n"
+            "       %s --image program.bf image.bfi\n"
+            "  compiles program.bf into an image file, for the `image` command after `xxd -p image.bfi`\n",
+            name, name, name);
+}
+
+/**
+ write the bytes of an array to a generated header
+
+ @param out      the header
+ @param source   the program it was made from
+ @param comment  what the array holds
+ @param type     element type
+ @param name     array name
+ @param elements number of elements
+ @param per_line elements on a line
+ @param element  prints one element
+*/
+template <typename Element>
+void write_array(FILE * out, const char * source, const std::string & comment, const char * type, const std::string & name,
+                 size_t elements, size_t per_line, Element element) {
+    const char * base = strrchr(source, '/');
+    base = base ? base + 1 : source;
+    fprintf(out, "// generated by pico_bf_pack from %s, do not edit\n"
+                 "#pragma once\n"
+                 "\n"
+                 "#include <cstdint>\n"
+                 "\n"
+                 "/// %s %s\n"
+                 "static const %s %s[] = {",
+            base, base, comment.c_str(), type, name.c_str());
+    for (size_t i = 0; i < elements; i++) {
+        fprintf(out, "%s", i % per_line ? " " : "\n    ");
+        element(i);
+        fprintf(out, ",");
+    }
+    fprintf(out, "\n};\n");
+}
+
+int main(int argc, char ** argv) {
+    int first = argc > 1 && strcmp(argv[1], "--image") == 0 ? 2 : 1;
+    bool image = first == 2;
+    int args = argc - first;
+    // only an image can be written without a name, as a file of its own
+    if (args != 3 && !(image && args == 2)) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char * input_path = argv[first];
+    const char * output_path = argv[first + 1];
+    const char * name = args == 3 ? argv[first + 2] : nullptr;
+
+    mapped_file file;
+    std::vector<char> fallback;
+    const char * source = nullptr;
+    size_t len = 0;
+    if (!load_file(input_path, file, fallback, source, len)) {
+        return 1;
+    }
+
+    std::vector<uint8_t> packed;
+    std::vector<uint32_t> words;
+    if (image) {
+        auto program = compile_program(source, len);
+        if (!program) {
+            fprintf(stderr, "%s: unbalanced brackets\n", input_path);
+            return 1;
+        }
+        words = build_image(*program);
+        if (words.empty()) {
+            fprintf(stderr, "%s: too large for an image\n", input_path);
+            return 1;
+        }
+    } else {
+        packed = pack_bf(source, len);
+        if (!compile_packed(packed.data(), packed.size())) {
+            fprintf(stderr, "%s: unbalanced brackets\n", input_path);
+            return 1;
+        }
+    }
+
+    FILE * out = fopen(output_path, name ? "w" : "wb");
+    if (!out) {
+        perror(output_path);
+        return 1;
+    }
+    if (!name) {
+        fwrite(words.data(), sizeof(uint32_t), words.size(), out);
+    } else if (image) {
+        write_array(out, input_path, "compiled into an image for run_image, " + std::to_string(words.size()) + " words",
+                    "uint32_t", std::string(name) + "_image", words.size(), 8,
+                    [&](size_t i) { fprintf(out, "0x%08x", words[i]); });
+    } else {
+        bf_unpacker unpacker(packed.data(), packed.size());
+        write_array(out, input_path, "packed for bf_unpacker, " + std::to_string(unpacker.ops) + " ops in " +
+                    std::to_string(packed.size()) + " bytes",
+                    "uint8_t", std::string(name) + "_packed", packed.size(), 16,
+                    [&](size_t i) { fprintf(out, "0x%02x", packed[i]); });
+    }
+    if (fclose(out) != 0) {
+        perror(output_path);
+        return 1;
+    }
+    return 0;
+}
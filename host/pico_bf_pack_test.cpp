@@ -0,0 +1,83 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "brainfuck_pack.h"
+
+#pragma mark - tests
+
+/// checks that failed so far
+static int failures = 0;
+
+/**
+ report a failed check
+
+ @param ok   the check
+ @param what what was checked
+*/
+static void check(bool ok, const char * what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ unpack a packed program
+
+ @param packed packed program
+ @return its ops, empty if the header is bad
+*/
+static std::string unpack(const std::vector<uint8_t> & packed) {
+    bf_unpacker unpacker(packed.data(), packed.size());
+    std::string ops;
+    for (int c; (c = unpacker.next()) != -1;) {
+        ops.push_back(char(c));
+    }
+    return ops;
+}
+
+/// comments are dropped, the commands come back in order
+static void test_round_trip() {
+    const char * source = "++ a comment [>+<-] >. ,[.,]";
+    check(unpack(pack_bf(source, strlen(source))) == "++[>+<-]>.,[.,]", "a short program round trips without comments");
+    check(unpack(pack_bf("", 0)).empty(), "an empty program round trips");
+}
+
+/// sources packing to more than 64 KiB still match the runs at the start
+static void test_past_16_bit_offsets() {
+    // a few motifs repeated at random, with stray ops so the runs stay varied
+    std::mt19937 rng(3);
+    const char * ops = "+-<>[].,";
+    std::vector<std::string> motifs;
+    for (int m = 0; m < 64; m++) {
+        std::string motif;
+        for (int k = 8 + rng() % 24; k > 0; k--) {
+            motif += ops[rng() % 8];
+        }
+        motifs.push_back(motif);
+    }
+    std::string source;
+    while (source.size() < 1500000) {
+        source += rng() % 4 == 0 ? std::string(1, ops[rng() % 8]) : motifs[rng() % motifs.size()];
+    }
+
+    std::vector<uint8_t> packed = pack_bf(source.data(), source.size());
+    check(packed.size() > 0x10000, "the test source packs to more than 64 KiB");
+    check(unpack(packed) == source, "a source packing to more than 64 KiB round trips");
+    // matches can only point into the first 64 KiB, the motifs are all there to match
+    check(packed.size() < source.size() / 2, "matches keep being found past 64 KiB of output");
+}
+
+int main() {
+    test_round_trip();
+    test_past_16_bit_offsets();
+    if (failures) {
+        fprintf(stderr, "%d pack checks failed\n", failures);
+        return 1;
+    }
+    printf("pack checks pass\n");
+    return 0;
+}
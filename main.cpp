@@ -1,230 +1,1296 @@
 #include <stdio.h>
+#include <errno.h>
+#include <malloc.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
 #include <cstring>
 #include <string>
 #include <sstream>
-#include <array>
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <optional>
-#include <stack>
-#include <variant>
-#include <vector>
+#include "brainfuck_vm.h"
+#include "brainfuck_diag.h"
+#include "brainfuck_ir.h"
+#include "brainfuck_clock.h"
+#include "brainfuck_estimate.h"
+#include "brainfuck_bench.h"
+#include "brainfuck_pack.h"
+#include "brainfuck_image.h"
+#include "brainfuck_cache.h"
+#include "brainfuck_queue.h"
 #include "peko.h"
+#include "peko_image.h"
 
-/// brainfuck virtual machine tape length
-#define BRAINFUCK_VM_TAPE_LEN 30000
-
-// https://schneide.blog/2018/01/11/c17-the-two-line-visitor-explained/
-template<class... Ts> struct brainfuck_vm : Ts... { using Ts::operator()...; };
-template<class... Ts> brainfuck_vm(Ts...) -> brainfuck_vm<Ts...>;
-
-#pragma mark - brainfuck ops
-
-struct increment_value_op {}; // +
-struct decrement_value_op {}; // -
-
-struct increment_ptr_op {};   // >
-struct decrement_ptr_op {};   // <
-
-struct print_op {};           // ,
-struct read_op {};            // .
-
-struct loop_start_op {};      // [
-struct loop_end_op {};        // ]
-
-/// brainfuck_op allowed ops in C++17 std::variant
-using brainfuck_op = std::variant<
-    increment_value_op,
-    decrement_value_op,
-    increment_ptr_op,
-    decrement_ptr_op,
-    print_op,
-    read_op,
-    loop_start_op,
-    loop_end_op,
-    std::monostate
->;
-
-/// a map from char to brainfuck_op
-const std::map<char, brainfuck_op> bf_op_map {
-    {'+', increment_value_op{}},
-    {'-', decrement_value_op{}},
-    {'>', increment_ptr_op{}},
-    {'<', decrement_ptr_op{}},
-    {'.', print_op{}},
-    {',', read_op{}},
-    {'[', loop_start_op{}},
-    {']', loop_end_op{}}
+#pragma mark - arguments
+
+/**
+ parse a REPL argument as a decimal number, strtoull alone reads anything else as 0
+
+ @param text  the argument
+ @param value set to the number
+ @return whether all of `text` is a decimal number that fits in 64 bits
+*/
+bool parse_number(const std::string & text, uint64_t & value) {
+    if (text.empty() || text[0] < '0' || text[0] > '9') {
+        return false;
+    }
+    char * end;
+    errno = 0;
+    value = strtoull(text.c_str(), &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
+
+#pragma mark - clock scaling
+
+/// how the REPL drives the system clock
+enum class clock_mode {
+    /// stay at BRAINFUCK_CLOCK_NORMAL_KHZ
+    normal,
+    /// stay at BRAINFUCK_CLOCK_BOOST_KHZ
+    boost,
+    /// boost while running brainfuck code, drop back to normal while waiting for input
+    automatic,
+    /// stay at a clock given by the user
+    fixed
 };
 
-#pragma mark - brainfuck vm
-
-/// brainfuck virtual machine status
-struct brainfuck_vm_status {
-    /// virtual infinity length tape
-    std::map<int, char> tape;
-    /// current cell of the tape
-    int tape_ptr = 0;
-
-    /// used for keeping track of all valid brainfuck_op
-    std::vector<char> instruction;
-    /// current brainfuck_op index
-    int instruction_ptr_current = -1;
-    /// keeping track of loops
-    std::stack<int> instruction_loop_ptr;
-
-    /// flag of skipping loop, e.g
-    /// +-[[[------------++++++++++-.>>[>]>>>--<<<<<<--]]]++++
-    ///   ^skipping from, but we need all                ^end of skipping
-    ///      instructions inside.
-    int jump_loop = 0;
+/// clock_control backed by the RP2040 PLL and voltage regulator
+struct pico_clock : clock_control {
+    uint32_t get_khz() const override {
+        return clock_get_hz(clk_sys) / 1000;
+    }
+
+    bool can_set_khz(uint32_t khz) const override {
+        uint vco, postdiv1, postdiv2;
+        return check_sys_clock_khz(khz, &vco, &postdiv1, &postdiv2);
+    }
+
+    bool set_khz(uint32_t khz) override {
+        return set_sys_clock_khz(khz, false);
+    }
+
+    void set_voltage(core_voltage voltage) override {
+        static const enum vreg_voltage levels[] = {
+            VREG_VOLTAGE_1_10,
+            VREG_VOLTAGE_1_15,
+            VREG_VOLTAGE_1_20,
+            VREG_VOLTAGE_1_25,
+            VREG_VOLTAGE_1_30
+        };
+        vreg_set_voltage(levels[static_cast<int>(voltage)]);
+        // give the regulator time to settle
+        sleep_ms(10);
+    }
+
+    uint64_t now_us() const override {
+        return time_us_64();
+    }
 };
 
-#pragma mark - helper function
+/// the program run by the `example` command
+const char * example_program = "+++++ +++[- >++++ ++++< ]>+++ +++++ +++++ +++.< +++++ [->++ +++<] >.---"\
+"---.< +++[- >+++< ]>+++ .<+++ +++[- >---- --<]> ----- ----- --.<+ +++[-"\
+">++++ <]>+. <++++ [->++ ++<]> +++++ .++++ ++.++ ++.<+ +++++ ++[-> -----"\
+"---<] >---- ----- ----- .<+++ +++++ +++++ [->++ +++++ +++++ +<]>+ +++++"\
+"+++++ +++++ +++++ ++++. <++++ +++++ [->-- ----- --<]> ----- ----- -----"\
+"--.<+ +++++ +[->+ +++++ +<]>+ +++++ ++.<+ +++++ [->++ ++++< ]>+++ ++.<+"\
+"+++++ +++[- >---- ----- <]>-- ----- ----- ----- .<+++ +[->+ +++<] >++.<"\
+"+++++ +++[- >++++ ++++< ]>+++ +++++ +++++ +++.< +++++ ++++[ ->--- -----"\
+"-<]>- ----- ----- ----- -.<++ +++++ [->++ +++++ <]>++ +++++ +.<++ ++++["\
+"->+++ +++<] >++++ +.<++ +++++ ++[-> ----- ----< ]>--- ----- ----- ----."\
+"<++++ [->++ ++<]> ++.<+ +++++ ++[-> +++++ +++<] >++++ +++++ +++++ ++.<+"\
+"+++++ +++[- >---- ----- <]>-- ----- ----- ----- .<+++ ++++[ ->+++ ++++<"\
+"]>+++ +++++ .<+++ +++[- >++++ ++<]> +++++ .<+++ +++++ +[->- ----- ---<]"\
+">---- ----- ----- ---.< ++++[ ->+++ +<]>+ +.<++ +++++ ++[-> +++++ ++++<"\
+"]>+++ +++++ +++.< +++++ ++[-> ----- --<]> --.<+ +++++ +[->- ----- -<]>-"\
+"----- ----. <";
+
+/// the RP2040 system clock
+pico_clock system_clock;
+/// current clock policy of the REPL
+clock_mode system_clock_mode = clock_mode::normal;
 
 /**
- next brainfuck op
+ handle the `clock` REPL command
 
- @param status   the brainfuck vm status
- @param char_op  character form op
- @param via_loop due to the way I wrote, a flag is needed to avoid re-adding ops
- @return brainfuck_op
+ @param args everything after `clock`, one of "", "normal", "boost", "auto" or a clock in kHz
 */
-brainfuck_op next_op(brainfuck_vm_status & status, char char_op, bool via_loop = false) {
-    // find the brainfuck_op from bf_op_map
-    if (auto op = bf_op_map.find(char_op); op != bf_op_map.end()) {
-        // do not append the char_op if we're retriving the next op inside a loop_op
-        if (!via_loop) {
-            // save char_op to instruction
-            status.instruction.emplace_back(char_op);
-            // increse the ptr of current instruction
-            status.instruction_ptr_current++;
+void clock_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "normal") {
+        system_clock_mode = clock_mode::normal;
+        scale_clock(system_clock, BRAINFUCK_CLOCK_NORMAL_KHZ);
+    } else if (mode == "boost") {
+        system_clock_mode = clock_mode::boost;
+        scale_clock(system_clock, BRAINFUCK_CLOCK_BOOST_KHZ);
+    } else if (mode == "auto") {
+        system_clock_mode = clock_mode::automatic;
+        scale_clock(system_clock, BRAINFUCK_CLOCK_NORMAL_KHZ);
+    } else if (!mode.empty()) {
+        uint64_t khz;
+        if (parse_number(mode, khz) && khz <= UINT32_MAX && scale_clock(system_clock, uint32_t(khz))) {
+            system_clock_mode = clock_mode::fixed;
+        } else {
+            printf("cannot run at %s kHz\n", mode.c_str());
         }
+    }
+
+    static const char * mode_names[] = {"normal", "boost", "auto", "fixed"};
+    printf("clock: %lu kHz (%s)\n", (unsigned long)system_clock.get_khz(), mode_names[static_cast<int>(system_clock_mode)]);
+}
 
-        // return next op
-        return op->second;
+#pragma mark - cost estimation
+
+/**
+ handle the `estimate` REPL command
+
+ @param args everything after `estimate`, "example", "peko" or brainfuck source
+*/
+void estimate_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string name;
+    stream >> name;
+    std::optional<brainfuck_block> program;
+    if (name == "example") {
+        program = compile_bf(example_program, strlen(example_program));
+    } else if (name == "peko") {
+        program = compile_packed(peko_packed, sizeof(peko_packed));
     } else {
-        // invaild char for brainfuck
-        // monostate is returned
-        return std::monostate();
+        program = compile_bf(args.data(), args.length());
+    }
+    if (!program) {
+        printf("estimate: unbalanced brackets\n");
+        return;
+    }
+
+    cost_estimate estimate = estimate_cost(*program);
+    if (estimate.diverges) {
+        printf("estimate: the program never terminates, %llu ops before the endless loop\n",
+               (unsigned long long)estimate.ops);
+        return;
     }
+
+    uint64_t rate = calibrate_ops_per_second(system_clock);
+    // split so extrapolated counts do not overflow the multiply
+    uint64_t us = estimate.ops / rate * 1000000 + estimate.ops % rate * 1000000 / rate;
+    // a lower bound when the sample budget ran out, approximate when loops were extrapolated
+    const char * bound = estimate.exact ? "" : estimate.truncated ? ">" : "~";
+    printf("estimate: %s%llu ops, %s%llu.%03llu ms at %lu kHz (%llu ops/s)\n",
+           bound, (unsigned long long)estimate.ops,
+           bound, (unsigned long long)(us / 1000), (unsigned long long)(us % 1000),
+           (unsigned long)system_clock.get_khz(), (unsigned long long)rate);
+    printf("          %lu loops in closed form, %lu extrapolated, %llu ops sampled%s\n",
+           (unsigned long)estimate.closed_form_loops, (unsigned long)estimate.extrapolated_loops,
+           (unsigned long long)estimate.sampled_ops,
+           estimate.reads_input ? ", input assumed to be 0" : "");
 }
 
-#pragma mark - brainfuck vm interpreter
+#pragma mark - tape mode
+
+/// whether new vms start with a circular tape
+bool circular_tape = false;
 
 /**
- run brainfuck vm
+ give a fresh vm the tape selected by the user
 
- @param status   run brainfuck vm from the given state
- @param char_op  character form op
- @param via_loop due to the way I wrote, a flag is needed to avoid re-adding ops
+ @param status the brainfuck vm status
 */
-void run_vm(brainfuck_vm_status & status, char char_op, bool via_loop = false) {
-    // get the op from char_op
-    brainfuck_op op = next_op(status, char_op, via_loop);
+void setup_tape(brainfuck_vm_status & status) {
+    if (circular_tape) {
+        use_ring_tape(status, BRAINFUCK_VM_RING_TAPE_LOG2);
+    } else {
+        use_infinite_tape(status);
+    }
+}
 
-    // parttern matching
-    std::visit(brainfuck_vm {
-        [&](increment_value_op) {
-            // printf("increment_value_op\n");
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                status.tape[status.tape_ptr]++;
-            }
-        },
-        [&](decrement_value_op) {
-            // printf("decrement_value_op\n");
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                status.tape[status.tape_ptr]--;
+/**
+ handle the `circular` REPL command, switching the tape clears it
+
+ @param status the brainfuck vm status
+ @param args   everything after `circular`, one of "", "on" or "off"
+*/
+void circular_command(brainfuck_vm_status & status, const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "on" || mode == "off") {
+        circular_tape = mode == "on";
+        setup_tape(status);
+        reset_vm(status);
+    }
+
+    if (circular_tape) {
+        printf("tape: circular, %lu cells\n", (unsigned long)status.ring.size());
+    } else {
+        printf("tape: infinite\n");
+    }
+}
+
+#pragma mark - memory diagnostics
+
+/// word painted over unused stack at boot, words still holding it were never touched
+#define BRAINFUCK_STACK_PAINT 0xbfbfbfbfu
+
+#if PICO_ON_DEVICE
+// symbols from the sdk linker script
+extern "C" {
+extern uint32_t __StackTop, __StackBottom;
+extern uint32_t __StackOneTop, __StackOneBottom;
+extern char __end__, __StackLimit;
+}
+#endif
+
+/// print the memory report after every run
+bool memory_report_after_run = false;
+
+#if PICO_ON_DEVICE
+/**
+ fill a stack region with BRAINFUCK_STACK_PAINT
+
+ @param bottom lowest word of the region
+ @param top    one past the highest word to paint
+*/
+void paint_stack(uint32_t * bottom, uint32_t * top) {
+    for (uint32_t * word = bottom; word < top; word++) {
+        *word = BRAINFUCK_STACK_PAINT;
+    }
+}
+
+/**
+ measure a painted stack region, the stack grows down from `top`
+
+ @param bottom lowest word of the region
+ @param top    one past the highest word of the region
+ @return stack_usage
+*/
+stack_usage measure_stack(const uint32_t * bottom, const uint32_t * top) {
+    stack_usage usage;
+    usage.size = uint32_t((top - bottom) * sizeof(uint32_t));
+    const uint32_t * word = bottom;
+    while (word < top && *word == BRAINFUCK_STACK_PAINT) {
+        word++;
+    }
+    usage.peak = uint32_t((top - word) * sizeof(uint32_t));
+    usage.overflowed = bottom < top && *bottom != BRAINFUCK_STACK_PAINT;
+    return usage;
+}
+#endif
+
+/**
+ paint the unused part of both core stacks, call as early as possible on core 0
+*/
+void paint_stacks() {
+#if PICO_ON_DEVICE
+    // keep clear of our own frame
+    uint32_t marker;
+    paint_stack(&__StackBottom, &marker - 32);
+    // core 1 is not running yet, the whole region is free
+    paint_stack(&__StackOneBottom, &__StackOneTop);
+#endif
+}
+
+/**
+ fill in the heap and stack part of a memory_report
+
+ @param report the report
+*/
+void measure_platform_memory(memory_report & report) {
+#if PICO_ON_DEVICE
+    struct mallinfo heap = mallinfo();
+    report.heap_in_use = heap.uordblks;
+    // newlib never gives memory back to sbrk, the arena is the high-water mark
+    report.heap_peak = heap.arena;
+    report.heap_total = uint32_t(&__StackLimit - &__end__);
+    report.stack[0] = measure_stack(&__StackBottom, &__StackTop);
+    report.stack[1] = measure_stack(&__StackOneBottom, &__StackOneTop);
+#else
+    (void)report;
+#endif
+}
+
+/**
+ take a memory_report of the firmware and the vm
+
+ @param status the brainfuck vm status
+ @return memory_report
+*/
+memory_report measure_memory(const brainfuck_vm_status & status) {
+    memory_report report;
+    measure_platform_memory(report);
+    measure_vm_memory(status, report);
+    return report;
+}
+
+/**
+ handle the `mem` REPL command
+
+ @param status the brainfuck vm status
+ @param args   everything after `mem`, one of "", "on" or "off"
+*/
+void memory_command(const brainfuck_vm_status & status, const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "on" || mode == "off") {
+        memory_report_after_run = mode == "on";
+        return;
+    }
+    print_memory_report(measure_memory(status));
+}
+
+/**
+ handle the `trace` REPL command
+
+ @param args everything after `trace`, one of "on", "off" or the number of events to dump (default 16)
+*/
+void trace_command(const std::string & args) {
+#if BRAINFUCK_VM_TRACE
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "on" || mode == "off") {
+        trace_enabled = mode == "on";
+        printf("trace: %s\n", mode.c_str());
+        return;
+    }
+
+    uint64_t count = 16;
+    if (!mode.empty() && !parse_number(mode, count)) {
+        printf("trace: %s is not a count\n", mode.c_str());
+        return;
+    }
+    print_trace(uint32_t(std::min<uint64_t>(count, UINT32_MAX)));
+#else
+    (void)args;
+    printf("trace: not compiled in, build with BRAINFUCK_VM_TRACE=1\n");
+#endif
+}
+
+/**
+ handle the `profile` REPL command
+
+ @param args everything after `profile`, one of "", "on" or "off"
+*/
+void profile_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "on" || mode == "off") {
+        profile_enabled = mode == "on";
+        printf("profile: %s\n", mode.c_str());
+        return;
+    }
+    print_tape_profile();
+}
+
+#pragma mark - fuel
+
+/// compiled ops a run may execute before it is suspended, 0 for no limit
+uint64_t fuel_budget = 0;
+
+/**
+ handle the `fuel` REPL command
+
+ @param args everything after `fuel`, "", "off" or the number of compiled ops per run
+*/
+void fuel_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string budget;
+    stream >> budget;
+    if (budget == "off") {
+        fuel_budget = 0;
+    } else if (!budget.empty()) {
+        uint64_t ops;
+        if (!parse_number(budget, ops)) {
+            // a typo must not turn into 0, which means unlimited
+            printf("fuel: %s is not a number of ops\n", budget.c_str());
+            return;
+        }
+        fuel_budget = ops;
+    }
+
+    if (fuel_budget == 0) {
+        printf("fuel: unlimited\n");
+    } else {
+        printf("fuel: %llu ops per run\n", (unsigned long long)fuel_budget);
+    }
+}
+
+#pragma mark - usb io
+
+/// set while core 1 reads an upload, core 0 must not touch stdin then
+std::atomic<bool> stdin_busy{false};
+
+/// brainfuck_io over USB serial that can tell whether input is waiting,
+/// so the compiled engine suspends on `,` instead of blocking in getchar
+struct usb_io : brainfuck_io {
+    void put(char c) override {
+        putchar(c);
+    }
+
+    int get() override {
+        if (pending >= 0) {
+            int c = pending;
+            pending = -1;
+            return c;
+        }
+        return getchar();
+    }
+
+    bool ready() override {
+        if (pending < 0 && !stdin_busy) {
+            int c = getchar_timeout_us(0);
+            if (c >= 0) {
+                pending = c;
             }
-        },
-        [&](increment_ptr_op) {
-            // printf("increment_ptr_op\n");
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                status.tape_ptr++;
+        }
+        return pending >= 0;
+    }
+
+    /// byte read by ready() and not yet by get(), or -1
+    int pending = -1;
+};
+
+/// io of the vm unless `digest on`
+usb_io usb;
+
+#pragma mark - output digest
+
+/// takes the place of the USB output while `digest on`
+digest_io output_digest(&usb);
+/// set by the `digest` REPL command
+bool digest_enabled = false;
+
+/**
+ handle the `digest` REPL command
+
+ @param status the brainfuck vm status
+ @param args   everything after `digest`, one of "", "on" or "off"
+*/
+void digest_command(brainfuck_vm_status & status, const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode == "on" || mode == "off") {
+        digest_enabled = mode == "on";
+        status.io = digest_enabled ? static_cast<brainfuck_io *>(&output_digest) : &usb;
+    }
+    printf("digest: %s\n", digest_enabled ? "on" : "off");
+}
+
+/**
+ print the digest of the output so far, if `digest on`
+*/
+void print_digest() {
+    if (digest_enabled) {
+        printf("\ndigest: %016llx, %llu bytes\n",
+               (unsigned long long)output_digest.digest, (unsigned long long)output_digest.written);
+    }
+}
+
+#pragma mark - benchmark
+
+/// timed runs per program of `bench json`
+#define BRAINFUCK_BENCH_REPEATS 5
+
+/**
+ handle the `bench` REPL command
+
+ @param args everything after `bench`, "" for ops/s at each clock or "json" for the built-in programs as JSON
+*/
+void bench_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (mode != "json") {
+        static const uint32_t khz[] = {BRAINFUCK_CLOCK_NORMAL_KHZ, 200000, BRAINFUCK_CLOCK_BOOST_KHZ};
+        run_clock_benchmark(system_clock, khz, sizeof(khz) / sizeof(khz[0]));
+        return;
+    }
+
+    std::vector<bench_result> results;
+    results.push_back(run_benchmark(system_clock, "example", example_program, strlen(example_program), BRAINFUCK_BENCH_REPEATS));
+    measure_platform_memory(results.back().memory);
+    // peko only exists packed
+    results.push_back(run_benchmark(system_clock, "peko", compile_packed(peko_packed, sizeof(peko_packed)),
+                                    bf_unpacker(peko_packed, sizeof(peko_packed)).ops, BRAINFUCK_BENCH_REPEATS));
+    measure_platform_memory(results.back().memory);
+    results.push_back(run_benchmark(system_clock, "kernel", clock_benchmark_kernel, strlen(clock_benchmark_kernel), BRAINFUCK_BENCH_REPEATS));
+    measure_platform_memory(results.back().memory);
+    print_bench_json(stdout, "rp2040", system_clock.get_khz(), results);
+}
+
+#pragma mark - image cache
+
+/// flash at the end of the chip kept for cached images, past the end of the firmware
+#define BRAINFUCK_CACHE_BYTES (256 * 1024)
+/// programs with fewer ops compile faster than a flash write, they are not cached
+#define BRAINFUCK_CACHE_MIN_OPS 512
+/// cached images up to this size are copied into SRAM, larger ones run from flash through XIP
+#define BRAINFUCK_CACHE_SRAM_BYTES (32 * 1024)
+
+/// bounds of the firmware in flash, from the sdk linker script
+extern "C" char __flash_binary_start;
+extern "C" char __flash_binary_end;
+
+/**
+ write to flash with nothing else running from it
+
+ @param write erases or programs flash
+*/
+template <typename Write>
+void with_flash_to_ourselves(Write write) {
+    // core 1 only runs uploads, which are over by now, and must not fetch from flash meanwhile
+    multicore_reset_core1();
+    uint32_t interrupts = save_and_disable_interrupts();
+    write();
+    restore_interrupts(interrupts);
+}
+
+/// the last BRAINFUCK_CACHE_BYTES of flash, read in place through XIP
+struct flash_storage : cache_storage {
+    /// offset of the region from the start of flash
+    static constexpr uint32_t offset = PICO_FLASH_SIZE_BYTES - BRAINFUCK_CACHE_BYTES;
+
+    const uint8_t * data() const override {
+        return reinterpret_cast<const uint8_t *>(XIP_BASE + offset);
+    }
+
+    size_t size() const override {
+        return BRAINFUCK_CACHE_BYTES;
+    }
+
+    void erase() override {
+        // a sector at a time, interrupts are only held off for one erase, blank sectors are skipped
+        for (uint32_t sector = 0; sector < BRAINFUCK_CACHE_BYTES; sector += FLASH_SECTOR_SIZE) {
+            const uint8_t * bytes = data() + sector;
+            if (std::all_of(bytes, bytes + FLASH_SECTOR_SIZE, [](uint8_t byte) { return byte == 0xff; })) {
+                continue;
             }
-        },
-        [&](decrement_ptr_op) {
-            // printf("decrement_ptr_op\n");
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                status.tape_ptr--;
+            with_flash_to_ourselves([&] { flash_range_erase(offset + sector, FLASH_SECTOR_SIZE); });
+        }
+    }
+
+    void program(size_t at, const uint8_t * bytes, size_t len) override {
+        // a sector at a time too, like erase
+        for (size_t done = 0; done < len; done += FLASH_SECTOR_SIZE) {
+            size_t chunk = std::min<size_t>(len - done, FLASH_SECTOR_SIZE);
+            with_flash_to_ourselves([&] { flash_range_program(offset + uint32_t(at + done), bytes + done, chunk); });
+        }
+    }
+};
+
+static_assert(BRAINFUCK_CACHE_BYTES % FLASH_SECTOR_SIZE == 0, "the cache is erased in whole sectors");
+static_assert(BRAINFUCK_CACHE_ALIGN % FLASH_PAGE_SIZE == 0, "entries are programmed in whole pages");
+
+/// set by the `cache` REPL command, the image engine then caches what it compiles
+bool cache_enabled = true;
+/// lookups of the image engine that found an image, or had to compile one
+uint32_t cache_hits = 0;
+uint32_t cache_misses = 0;
+
+/**
+ identity of this firmware, the FNV-1a of its whole binary folded to 32 bits,
+ so any change to it invalidates the cache
+
+ @return the build id
+*/
+uint32_t firmware_build_id() {
+    static uint32_t build_id = 0;
+    if (build_id == 0) {
+        uint64_t hash = BRAINFUCK_DIGEST_OFFSET;
+        for (const char * byte = &__flash_binary_start; byte < &__flash_binary_end; byte++) {
+            hash = (hash ^ static_cast<unsigned char>(*byte)) * BRAINFUCK_DIGEST_PRIME;
+        }
+        build_id = uint32_t(hash ^ (hash >> 32)) | 1;
+    }
+    return build_id;
+}
+
+/**
+ whether the cache region starts past the end of the firmware, it would overwrite it otherwise
+
+ @return whether the cache can be used
+*/
+bool cache_fits() {
+    return XIP_BASE + flash_storage::offset >= reinterpret_cast<uintptr_t>(&__flash_binary_end);
+}
+
+/**
+ the cache of compiled images in flash
+
+ @return image_cache
+*/
+image_cache & flash_cache() {
+    static flash_storage storage;
+    static image_cache cache(storage, firmware_build_id());
+    return cache;
+}
+
+/**
+ handle the `cache` REPL command
+
+ @param status the brainfuck vm status
+ @param args   everything after `cache`, "", "on", "off" or "clear"
+*/
+void cache_command(brainfuck_vm_status & status, const std::string & args) {
+    std::stringstream stream(args);
+    std::string mode;
+    stream >> mode;
+    if (!cache_fits()) {
+        printf("cache: the firmware reaches into the last %d KiB of flash, shrink BRAINFUCK_CACHE_BYTES\n",
+               BRAINFUCK_CACHE_BYTES / 1024);
+        return;
+    }
+    image_cache & cache = flash_cache();
+    if (mode == "on") {
+        cache_enabled = true;
+    } else if (mode == "off") {
+        cache_enabled = false;
+    } else if (mode == "clear") {
+        if (status.image) {
+            // it may be running from the cache
+            printf("dropping the run that is out of fuel\n");
+            status.image = nullptr;
+        }
+        cache.clear();
+    }
+    cache_stats stats = cache.stats();
+    printf("cache: %s, %lu images, %lu stale, %lu of %lu bytes, %lu hits, %lu misses, build %08lx\n",
+           cache_enabled ? "on" : "off", (unsigned long)stats.entries, (unsigned long)stats.stale,
+           (unsigned long)stats.used, (unsigned long)cache.storage.size(), (unsigned long)cache_hits,
+           (unsigned long)cache_misses, (unsigned long)cache.build_id);
+}
+
+#pragma mark - repl
+
+/// which engine runs brainfuck code
+enum class vm_engine {
+    /// compile_bf then run_compiled, supports fuel
+    compiled,
+    /// run_vm, one character at a time
+    reference,
+    /// compile_bf then build_image, run in place by run_image, peko runs its image from flash
+    image
+};
+
+/// engine selected by the `engine` REPL command
+vm_engine engine = vm_engine::compiled;
+
+/**
+ boost the clock for running brainfuck code, or drop it back afterwards, if asked to
+
+ @param running whether brainfuck code is about to run
+*/
+void clock_for_run(bool running) {
+    if (system_clock_mode == clock_mode::automatic) {
+        scale_clock(system_clock, running ? BRAINFUCK_CLOCK_BOOST_KHZ : BRAINFUCK_CLOCK_NORMAL_KHZ);
+    }
+}
+
+/// part of an upload compiled by core 1, cut at bracket depth 0
+struct upload_segment {
+    /// null for an empty segment
+    std::shared_ptr<const brainfuck_block> program;
+    /// no segment follows
+    bool last = false;
+    /// the source is unbalanced right after this segment
+    bool unbalanced = false;
+};
+
+/// segments of an upload after the one that ran out of fuel, `resume` runs them once it finishes,
+/// only while that segment is still pending: a new run or a fresh vm drops them
+std::deque<upload_segment> upload_rest;
+
+/**
+ report the end of a run on the compiled engine
+
+ @param status the brainfuck vm status
+ @param result how the run ended
+*/
+void finish_run(brainfuck_vm_status & status, run_result result) {
+    print_digest();
+
+    if (result == run_result::out_of_fuel && !upload_rest.empty()) {
+        printf("\nout of fuel after %llu ops, %lu uploaded segments follow, type resume [ops] to continue\n",
+               (unsigned long long)status.instruction_executed, (unsigned long)upload_rest.size());
+    } else if (result == run_result::out_of_fuel) {
+        printf("\nout of fuel after %llu ops, type resume [ops] to continue\n",
+               (unsigned long long)status.instruction_executed);
+    }
+    if (memory_report_after_run) {
+        printf("\n");
+        print_memory_report(measure_memory(status));
+    }
+}
+
+/**
+ what core 0 does while a run is suspended on `,`: the output so far goes out,
+ the clock drops and the core sleeps between polls until input arrives
+
+ @param status the brainfuck vm status, its run waiting for input
+*/
+void wait_for_input(brainfuck_vm_status & status) {
+    clock_for_run(false);
+    stdio_flush();
+    while (!status.io->ready()) {
+        sleep_ms(1);
+    }
+    clock_for_run(true);
+}
+
+/**
+ whether the vm holds a compiled program or an image that has not finished
+
+ @param status the brainfuck vm status
+ @return whether there is a run to resume
+*/
+bool run_pending(const brainfuck_vm_status & status) {
+    return !status.frames.empty() || status.image;
+}
+
+/**
+ a new run is about to replace the one that can be resumed, if any,
+ a tape sized for the whole program that ran last goes back to the tape the user selected
+
+ @param status the brainfuck vm status
+*/
+void drop_pending_run(brainfuck_vm_status & status) {
+    if (run_pending(status)) {
+        printf("dropping the run that is out of fuel\n");
+    }
+    upload_rest.clear();
+    if (status.mode == tape_mode::bounded) {
+        // only cells that program could reach are there, new code may move anywhere
+        setup_tape(status);
+        reset_vm(status);
+        if (profile_enabled) {
+            // the op count the profile windows follow started over
+            start_profile(status);
+        }
+    }
+}
+
+/**
+ run the loaded compiled program or image with the fuel it has, waiting whenever it needs input
+
+ @param status the brainfuck vm status
+ @return how the run ended, never waiting_for_input
+*/
+run_result run_loaded(brainfuck_vm_status & status) {
+    run_result result;
+    while ((result = status.image ? run_image(status) : run_compiled(status)) == run_result::waiting_for_input) {
+        wait_for_input(status);
+    }
+    return result;
+}
+
+/**
+ continue the loaded compiled program or image with the fuel it has, then the rest of an upload
+ it belongs to, printing a memory_report afterwards if asked to
+
+ @param status the brainfuck vm status
+*/
+void execute(brainfuck_vm_status & status) {
+    clock_for_run(true);
+    run_result result = run_loaded(status);
+    while (result == run_result::finished && !upload_rest.empty()) {
+        upload_segment segment = std::move(upload_rest.front());
+        upload_rest.pop_front();
+        if (segment.unbalanced) {
+            printf("\nunbalanced brackets, the upload stopped there\n");
+            upload_rest.clear();
+            break;
+        }
+        if (segment.program) {
+            load_program(status, std::move(segment.program));
+            result = run_loaded(status);
+        }
+    }
+    clock_for_run(false);
+    finish_run(status, result);
+}
+
+/**
+ get ready for a run: profile and digest start over
+
+ @param status the brainfuck vm status
+*/
+void start_run(brainfuck_vm_status & status) {
+    if (profile_enabled) {
+        start_profile(status);
+    }
+    output_digest.clear();
+}
+
+/**
+ report a run on the reference engine once its last op went through run_vm
+
+ @param status the brainfuck vm status
+*/
+void finish_reference_run(brainfuck_vm_status & status) {
+    clock_for_run(false);
+    print_digest();
+    if (memory_report_after_run) {
+        printf("\n");
+        print_memory_report(measure_memory(status));
+    }
+}
+
+/**
+ load a compiled program and execute it with the fuel_budget
+
+ @param status        the brainfuck vm status
+ @param program       the compiled program, std::nullopt if its brackets are unbalanced
+ @param whole_program whether program is a complete program run on a fresh vm,
+                      its tape can then be sized by static analysis
+*/
+void run_program(brainfuck_vm_status & status, std::optional<brainfuck_block> program, bool whole_program) {
+    if (!program) {
+        printf("unbalanced brackets\n");
+        return;
+    }
+    drop_pending_run(status);
+    std::shared_ptr<const brainfuck_program> shared = make_program(std::move(*program));
+    if (whole_program && !circular_tape) {
+        // whole programs are known upfront, allocate only the cells they can reach
+        size_tape_for(status, *shared);
+    }
+    load_program(status, shared);
+    status.fuel = fuel_budget ? fuel_budget : UINT64_MAX;
+    execute(status);
+}
+
+/// image the `image` command received or the image engine built, run from RAM
+std::vector<uint32_t> ram_image;
+
+/**
+ load a verified image and execute it in place with the fuel_budget
+
+ @param status        the brainfuck vm status
+ @param image         verified image, in flash or RAM, it must stay there while the run can be resumed
+ @param whole_program whether image is a complete program run on a fresh vm,
+                      its tape can then be sized from the image header
+*/
+void run_image_in_place(brainfuck_vm_status & status, const void * image, bool whole_program) {
+    drop_pending_run(status);
+    if (whole_program && !circular_tape) {
+        size_tape_for(status, image_extent(image));
+    }
+    load_image(status, image);
+    status.fuel = fuel_budget ? fuel_budget : UINT64_MAX;
+    execute(status);
+}
+
+/**
+ compile a program on the board into ram_image and execute it, for the image engine
+
+ @param status        the brainfuck vm status
+ @param program       the compiled program, std::nullopt if its brackets are unbalanced
+ @param whole_program whether program is a complete program run on a fresh vm
+ @param cache_key     key_source of the program to cache the image under, or nullptr
+*/
+void run_as_image(brainfuck_vm_status & status, std::optional<brainfuck_block> program, bool whole_program,
+                  const uint64_t * cache_key = nullptr) {
+    if (!program) {
+        printf("unbalanced brackets\n");
+        return;
+    }
+    // the image keeps no pointer into the program, the tree is freed before the run
+    std::vector<uint32_t> image = build_image(*make_program(std::move(*program)));
+    if (image.empty()) {
+        printf("program too large for an image\n");
+        return;
+    }
+    if (cache_key) {
+        // whatever was pending may run from the flash about to be written
+        status.image = nullptr;
+        flash_cache().store(*cache_key, image);
+    }
+    ram_image = std::move(image);
+    run_image_in_place(status, ram_image.data(), whole_program);
+}
+
+/**
+ run source on the image engine, straight from the flash cache if it was compiled before,
+ compiling it and caching the image otherwise
+
+ @param status        the brainfuck vm status
+ @param source        brainfuck source
+ @param len           length of source
+ @param whole_program whether source is a complete program run on a fresh vm
+*/
+void run_cached(brainfuck_vm_status & status, const char * source, size_t len, bool whole_program) {
+    uint32_t ops;
+    uint64_t key = key_source(source, len, ops);
+    if (!cache_enabled || !cache_fits() || ops < BRAINFUCK_CACHE_MIN_OPS) {
+        run_as_image(status, compile_bf(source, len), whole_program);
+        return;
+    }
+    size_t image_len;
+    const void * image = flash_cache().find(key, image_len);
+    if (!image) {
+        cache_misses++;
+        run_as_image(status, compile_bf(source, len), whole_program, &key);
+        return;
+    }
+    cache_hits++;
+    if (image_len <= BRAINFUCK_CACHE_SRAM_BYTES) {
+        // small images are worth a copy, SRAM never misses the XIP cache
+        const uint32_t * words = static_cast<const uint32_t *>(image);
+        ram_image.assign(words, words + image_len / sizeof(uint32_t));
+        image = ram_image.data();
+    }
+    run_image_in_place(status, image, whole_program);
+}
+
+/**
+ interpret brainfuck source on the vm with the fuel_budget
+
+ @param status        the brainfuck vm status
+ @param source        brainfuck source
+ @param len           length of source
+ @param whole_program whether source is a complete program run on a fresh vm,
+                      its tape can then be sized by static analysis
+*/
+void interpret(brainfuck_vm_status & status, const char * source, size_t len, bool whole_program) {
+    if (!whole_program && status.mode == tape_mode::bounded) {
+        // a whole program ran out of fuel on a tape sized for it, new code on any engine,
+        // run_vm included, would move past it
+        drop_pending_run(status);
+    }
+    start_run(status);
+    if (engine == vm_engine::reference) {
+        clock_for_run(true);
+        bind_ring_tape(status);
+        for (size_t i = 0; i < len; i++) {
+            // interpret
+            run_vm(status, source[i]);
+        }
+        finish_reference_run(status);
+        return;
+    }
+    if (engine == vm_engine::image) {
+        run_cached(status, source, len, whole_program);
+        return;
+    }
+    run_program(status, compile_bf(source, len), whole_program);
+}
+
+/**
+ interpret a whole packed program on the vm with the fuel_budget,
+ its ops are streamed out of flash and never unpacked into RAM
+
+ @param status the brainfuck vm status
+ @param packed packed program
+ @param len    length of packed
+*/
+void interpret_packed(brainfuck_vm_status & status, const uint8_t * packed, size_t len) {
+    start_run(status);
+    if (engine == vm_engine::reference) {
+        clock_for_run(true);
+        bind_ring_tape(status);
+        bf_unpacker unpacker(packed, len);
+        for (int c; (c = unpacker.next()) != -1;) {
+            run_vm(status, char(c));
+        }
+        finish_reference_run(status);
+        return;
+    }
+    if (engine == vm_engine::image) {
+        run_as_image(status, compile_packed(packed, len), true);
+        return;
+    }
+    run_program(status, compile_packed(packed, len), true);
+}
+
+/**
+ verify a whole image and execute it in place with the fuel_budget
+
+ @param status the brainfuck vm status
+ @param image  the image, in flash or RAM
+ @param len    length of image in bytes
+*/
+void interpret_image(brainfuck_vm_status & status, const void * image, size_t len) {
+    if (const char * error = verify_image(image, len)) {
+        printf("bad image: %s\n", error);
+        return;
+    }
+    start_run(status);
+    run_image_in_place(status, image, true);
+}
+
+/**
+ handle the `resume` REPL command
+
+ @param status the brainfuck vm status
+ @param args   everything after `resume`, "" for the fuel_budget or the number of compiled ops
+*/
+void resume_command(brainfuck_vm_status & status, const std::string & args) {
+    if (!run_pending(status)) {
+        printf("resume: nothing to resume\n");
+        return;
+    }
+    std::stringstream stream(args);
+    std::string budget;
+    stream >> budget;
+    uint64_t fuel = 0;
+    if (!budget.empty() && !parse_number(budget, fuel)) {
+        printf("resume: %s is not a number of ops\n", budget.c_str());
+        return;
+    }
+    if (fuel == 0) {
+        fuel = fuel_budget ? fuel_budget : UINT64_MAX;
+    }
+    status.fuel = fuel;
+    execute(status);
+}
+
+/**
+ handle the `engine` REPL command
+
+ @param args everything after `engine`, "", "compiled", "reference" or "image"
+*/
+void engine_command(const std::string & args) {
+    std::stringstream stream(args);
+    std::string name;
+    stream >> name;
+    if (name == "compiled") {
+        engine = vm_engine::compiled;
+    } else if (name == "reference") {
+        engine = vm_engine::reference;
+    } else if (name == "image") {
+        engine = vm_engine::image;
+    }
+    static const char * const names[] = {"compiled", "reference", "image"};
+    printf("engine: %s\n", names[int(engine)]);
+}
+
+#pragma mark - program upload
+
+/// ops core 1 compiles into a segment before cutting it after the next top-level loop
+#define BRAINFUCK_UPLOAD_SEGMENT_OPS 1024
+/// a pause in the upload this long hands what has been compiled so far to core 0
+#define BRAINFUCK_UPLOAD_IDLE_US 2000
+/// segments in flight between the cores
+#define BRAINFUCK_UPLOAD_QUEUE 8
+/// ends an upload, Ctrl-D
+#define BRAINFUCK_UPLOAD_END 4
+
+/// compiled segments from core 1 to core 0
+spsc_queue<upload_segment, BRAINFUCK_UPLOAD_QUEUE> upload_queue;
+/// set by core 0 when it stops running segments, core 1 then only drains the upload
+std::atomic<bool> upload_cancelled{false};
+/// set by core 1 once it has read the end of the upload
+std::atomic<bool> upload_done{false};
+
+/**
+ core 1 side of `upload`: read the source until Ctrl-D, compile it as it arrives
+ and hand it to core 0 in segments
+*/
+void upload_core1() {
+    bf_compiler compiler;
+    // unbalanced or cancelled, the rest of the upload is read and dropped
+    bool sending = true;
+    auto hand_over = [&](bool last, bool unbalanced) {
+        upload_segment segment;
+        segment.last = last;
+        segment.unbalanced = unbalanced;
+        if (!unbalanced && compiler.pc >= 0) {
+            segment.program = std::make_shared<const brainfuck_block>(std::move(*compiler.finish()));
+        }
+        // every segment gets a new compiler: the shared loop bodies of the old one must not
+        // change hands between the cores, their reference counts are not atomic on the M0+
+        compiler = bf_compiler();
+        sending = upload_queue.push(std::move(segment), upload_cancelled, tight_loop_contents) && !last;
+    };
+
+    while (true) {
+        int c = getchar_timeout_us(BRAINFUCK_UPLOAD_IDLE_US);
+        if (c == BRAINFUCK_UPLOAD_END) {
+            break;
+        }
+        if (!sending) {
+            continue;
+        }
+        if (c == PICO_ERROR_TIMEOUT) {
+            // nothing arriving, run what is there unless a loop is still open
+            if (compiler.pc >= 0 && compiler.blocks.size() == 1) {
+                hand_over(false, false);
             }
-        },
-        [&](print_op) {
-            // printf("print_op\n");
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                putchar(status.tape[status.tape_ptr]);
-                // printf("%c - %d\n", status.tape[status.tape_ptr], status.tape[status.tape_ptr]);
+            continue;
+        }
+        compiler.feed(char(c));
+        if (!compiler.balanced) {
+            hand_over(true, true);
+        } else if (c == ']' && compiler.blocks.size() == 1 && compiler.pc + 1 >= BRAINFUCK_UPLOAD_SEGMENT_OPS) {
+            hand_over(false, false);
+        }
+    }
+    if (sending) {
+        hand_over(true, compiler.blocks.size() != 1);
+    }
+    upload_done = true;
+}
+
+/**
+ handle the `upload` REPL command: core 1 reads and compiles the source while core 0 runs
+ the segments compiled so far on the compiled engine, so output starts during the upload
+
+ @param status the brainfuck vm status
+*/
+void upload_command(brainfuck_vm_status & status) {
+    printf("paste the program, end it with Ctrl-D\n");
+    drop_pending_run(status);
+    start_run(status);
+    upload_cancelled = false;
+    upload_done = false;
+    stdin_busy = true;
+    multicore_reset_core1();
+    multicore_launch_core1(upload_core1);
+
+    clock_for_run(true);
+    status.fuel = fuel_budget ? fuel_budget : UINT64_MAX;
+    run_result result = run_result::finished;
+    bool unbalanced = false;
+    // segments taken off the queue while a run waited for the upload to end
+    std::deque<upload_segment> backlog;
+    auto next_segment = [&](upload_segment & segment) {
+        if (backlog.empty()) {
+            return upload_queue.pop(segment, upload_cancelled, tight_loop_contents);
+        }
+        segment = std::move(backlog.front());
+        backlog.pop_front();
+        return true;
+    };
+    upload_segment segment;
+    while (next_segment(segment)) {
+        if (segment.program) {
+            load_program(status, std::move(segment.program));
+            while ((result = run_compiled(status)) == run_result::waiting_for_input) {
+                // input only comes after the upload, keep core 1 from blocking on a full queue till then
+                upload_segment queued;
+                while (!upload_done) {
+                    if (upload_queue.try_pop(queued)) {
+                        backlog.push_back(std::move(queued));
+                    }
+                }
+                stdin_busy = false;
+                wait_for_input(status);
             }
-        },
-        [&](read_op) {
-            // skip actual action if we're skipping loop
-            if (status.jump_loop == 0) {
-                status.tape[status.tape_ptr] = getchar();
+            if (result == run_result::out_of_fuel) {
+                break;
             }
-        },
-        [&](loop_start_op) {
-            // printf("loop from ins ptr: %d cond[%d]\n", status.instruction_ptr_current, status.tape[status.tape_ptr]);
-            // if and only if 1) `current_cell_value != 0`
-            //                2) and we're not do the skipping
-            // we can record the starting index of the if instruction
-            // besides, if we're in condition 1)
-            // the if statement should be also skipped
-            if (status.tape[status.tape_ptr] != 0 && status.jump_loop == 0) {
-                // push the starting instruction index of loop
-                status.instruction_loop_ptr.emplace(status.instruction_ptr_current);
-            } else {
-                status.jump_loop++;
+        }
+        if (segment.last) {
+            unbalanced = segment.unbalanced;
+            break;
+        }
+    }
+    clock_for_run(false);
+
+    // core 1 owns stdin until the end of the upload
+    if (result == run_result::out_of_fuel) {
+        // the rest is still compiled and kept, resume runs it after this segment
+        printf("\nout of fuel, end the upload with Ctrl-D\n");
+        while (!upload_done) {
+            if (upload_queue.try_pop(segment)) {
+                backlog.push_back(std::move(segment));
             }
-        },
-        [&](loop_end_op) {
-            // printf("loop end ins ptr: %d cond[%d]\n", status.instruction_ptr_current, status.tape[status.tape_ptr]);
-            // decrease the jump_loop value if we encounter the `]`
-            // and we were previously doing the skip
-            if (status.jump_loop != 0) {
-                status.jump_loop--;
-            } else {
-                // if we were not in skipping
-                // then we need to check the loop condition, `current_cell_value != 0`
-                if (status.tape[status.tape_ptr] != 0) {
-                    // the instruction range of current loop
-                    // printf("loop [%d, %d]:\n", status.instruction_loop_ptr.top(), status.instruction_ptr_current);
-#ifdef DEBUG
-                    // dump all instructions inside the loop
-                    // for (int debug = status.instruction_loop_ptr.top(); debug <= status.instruction_ptr_current; debug++) {
-                        // putchar(status.instruction[debug]);
-                    //}
-                    //putchar('\n');
-#endif
+        }
+        while (upload_queue.try_pop(segment)) {
+            backlog.push_back(std::move(segment));
+        }
+        upload_rest = std::move(backlog);
+    } else {
+        upload_cancelled = true;
+        while (!upload_done) {
+            tight_loop_contents();
+        }
+        while (upload_queue.try_pop(segment)) {
+            // segments compiled after the run stopped
+        }
+    }
+    stdin_busy = false;
+    if (unbalanced) {
+        printf("\nunbalanced brackets, the upload stopped there\n");
+    }
+    finish_run(status, result);
+}
 
-                    // loop the instruction until condition satisfies no more
-                    while (status.tape[status.tape_ptr] != 0) {
-                        // save current instruction pointer
-                        int current = status.instruction_ptr_current;
-                        // start the loop right after the index of `[`
-                        status.instruction_ptr_current = status.instruction_loop_ptr.top() + 1;
-                        // run one op at a time
-                        // until the next op is the corresponding `]`
-                        while (status.instruction_ptr_current < current) {
-                            run_vm(status, status.instruction[status.instruction_ptr_current], true);
-                            status.instruction_ptr_current++;
-                        }
-                        // restore the current instruction pointer
-                        status.instruction_ptr_current = current;
-                    }
+#pragma mark - image upload
 
-                    // pop current loop starting index
-                    status.instruction_loop_ptr.pop();
-                }
-            }
-        },
-        [&](std::monostate) {
+/**
+ value of a hex digit
+
+ @param c character
+ @return 0 to 15, or -1 if c is not a hex digit
+*/
+int hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/**
+ handle the `image` REPL command: read an image built on the host as hex until Ctrl-D,
+ verify it and run it in place, nothing is compiled on the board
+
+ @param status the brainfuck vm status, fresh
+*/
+void image_command(brainfuck_vm_status & status) {
+    printf("paste the image as hex (xxd -p image.bfi), end it with Ctrl-D\n");
+    ram_image.clear();
+    size_t len = 0;
+    int high = -1;
+    for (int c; (c = getchar()) != BRAINFUCK_UPLOAD_END;) {
+        int digit = hex_digit(c);
+        if (digit < 0) {
+            // whitespace and line breaks
+            continue;
+        }
+        if (high < 0) {
+            high = digit;
+            continue;
+        }
+        // bytes are packed into little endian words so the image is aligned for running in place
+        if (len % sizeof(uint32_t) == 0) {
+            ram_image.push_back(0);
+        }
+        ram_image.back() |= uint32_t(high << 4 | digit) << (8 * (len % sizeof(uint32_t)));
+        len++;
+        high = -1;
+    }
+    printf("%lu bytes\n", (unsigned long)len);
+    interpret_image(status, ram_image.data(), len);
+}
+
+/**
+ nesting depth of the brackets at the end of some source
+
+ @param source brainfuck source
+ @return the depth, or -1 if a `]` has no matching `[`
+*/
+int bracket_depth(const std::string & source) {
+    int depth = 0;
+    for (char c : source) {
+        if (c == '[') {
+            depth++;
+        } else if (c == ']' && --depth < 0) {
+            return -1;
         }
-    }, op);
+    }
+    return depth;
 }
 
 std::string getline(const char * prompt) {
@@ -253,65 +1319,151 @@ std::string getline(const char * prompt) {
     }
 }
 
-int run_bf(const char * run, bool print_run) {
+/**
+ start from a clean vm with the tape the user asked for
+
+ @param status the brainfuck vm status
+*/
+void fresh_vm(brainfuck_vm_status & status) {
+    upload_rest.clear();
+    if (status.mode == tape_mode::bounded) {
+        setup_tape(status);
+    }
+    reset_vm(status);
+}
+
+int run_bf(brainfuck_vm_status & status, const char * run, bool print_run) {
     const char * prompt = ">>>";
-    // the brainfuck vm
-    brainfuck_vm_status status;
+    // unless a program ran out of fuel and may still be resumed from the REPL
+    if (run != nullptr || !run_pending(status)) {
+        fresh_vm(status);
+    }
     if (run != nullptr) {
         if (print_run) {
             printf("%s\n\n", run);
         }
-        for (size_t i = 0; i < strlen(run); i++) {
-            // interpret
-            run_vm(status, run[i]);
-        }
+        interpret(status, run, strlen(run), true);
         printf("\n");
         return 1;
     }
+    // source of loops still open on previous lines
+    std::string pending;
     while (true) {
-        std::string input = getline(prompt);
+        std::string input = getline(pending.empty() ? prompt : "...");
         printf("\n");
         if (input == "reset") {
+            status.frames.clear();
+            status.image = nullptr;
             return 1;
         } else if (input == "example") {
             return 2;
         } else if (input == "peko") {
             return 3;
+        } else if (input.rfind("clock", 0) == 0) {
+            clock_command(input.substr(5));
+            continue;
+        } else if (input.rfind("circular", 0) == 0) {
+            circular_command(status, input.substr(8));
+            continue;
+        } else if (input.rfind("mem", 0) == 0) {
+            memory_command(status, input.substr(3));
+            continue;
+        } else if (input.rfind("trace", 0) == 0) {
+            trace_command(input.substr(5));
+            continue;
+        } else if (input.rfind("profile", 0) == 0) {
+            profile_command(input.substr(7));
+            continue;
+        } else if (input.rfind("estimate", 0) == 0) {
+            estimate_command(input.substr(8));
+            continue;
+        } else if (input.rfind("fuel", 0) == 0) {
+            fuel_command(input.substr(4));
+            continue;
+        } else if (input.rfind("resume", 0) == 0) {
+            resume_command(status, input.substr(6));
+            printf("\n");
+            continue;
+        } else if (input.rfind("engine", 0) == 0) {
+            engine_command(input.substr(6));
+            continue;
+        } else if (input.rfind("digest", 0) == 0) {
+            digest_command(status, input.substr(6));
+            continue;
+        } else if (input.rfind("bench", 0) == 0) {
+            bench_command(input.substr(5));
+            continue;
+        } else if (input.rfind("cache", 0) == 0) {
+            cache_command(status, input.substr(5));
+            continue;
+        } else if (input == "upload") {
+            upload_command(status);
+            printf("\n");
+            continue;
+        } else if (input == "image") {
+            fresh_vm(status);
+            image_command(status);
+            printf("\n");
+            continue;
         }
-        for (size_t i = 0; i < input.length(); i++) {
-            // interpret
-            run_vm(status, input[i]);
+        if (engine == vm_engine::compiled) {
+            // the compiled engine needs whole loops, keep reading until they are closed
+            pending += input;
+            int depth = bracket_depth(pending);
+            if (depth > 0) {
+                continue;
+            }
+            input.swap(pending);
+            pending.clear();
+            if (depth < 0) {
+                printf("unbalanced brackets\n");
+                continue;
+            }
         }
+        interpret(status, input.data(), input.length(), false);
         printf("\n");
     }
     return 0;
 }
 
 int main() {
+    paint_stacks();
     stdio_init_all();
+    // the brainfuck vm, reset rather than recreated between runs
+    brainfuck_vm_status status;
+    status.io = &usb;
     while (true) {
-        int ret = run_bf(nullptr, false);
+        int ret = run_bf(status, nullptr, false);
         if (ret == 1) {
-            printf("\nPicoBf by Cocoa v0.0.1\n  type reset to clear vm states\n  type example to see an example\n  type peko to peko!\n\n");
+            printf("\nPicoBf by Cocoa v0.0.1\n"
+                   "  type reset to clear vm states\n"
+                   "  type example to see an example\n"
+                   "  type peko to peko!\n"
+                   "  type clock [normal|boost|auto|kHz] to scale the system clock\n"
+                   "  type bench [json] to measure ops/s at each clock, or the built-in programs as JSON\n"
+                   "  type circular [on|off] to use a 32768-cell wraparound tape\n"
+                   "  type mem [on|off] to see heap, stack and vm memory usage\n"
+                   "  type trace [on|off|N] to record loops and I/O, or dump the last N events\n"
+                   "  type profile [on|off] to collect or print a tape access heatmap\n"
+                   "  type estimate [example|peko|<code>] to predict the runtime of a program\n"
+                   "  type fuel [ops|off] to bound each run, resume [ops] continues a run out of fuel\n"
+                   "  type engine [compiled|reference|image] to pick the interpreter\n"
+                   "  type digest [on|off] to hash the output instead of printing it\n"
+                   "  type upload to paste a large program, it runs while it is still arriving\n"
+                   "  type image to paste a program compiled on the host, it runs without compiling\n"
+                   "  type cache [on|off|clear] to keep what the image engine compiles in flash across resets\n"
+                   "\n");
         } else if (ret == 2) {
-            run_bf("+++++ +++[- >++++ ++++< ]>+++ +++++ +++++ +++.< +++++ [->++ +++<] >.---"\
-"---.< +++[- >+++< ]>+++ .<+++ +++[- >---- --<]> ----- ----- --.<+ +++[-"\
-">++++ <]>+. <++++ [->++ ++<]> +++++ .++++ ++.++ ++.<+ +++++ ++[-> -----"\
-"---<] >---- ----- ----- .<+++ +++++ +++++ [->++ +++++ +++++ +<]>+ +++++"\
-"+++++ +++++ +++++ ++++. <++++ +++++ [->-- ----- --<]> ----- ----- -----"\
-"--.<+ +++++ +[->+ +++++ +<]>+ +++++ ++.<+ +++++ [->++ ++++< ]>+++ ++.<+"\
-"+++++ +++[- >---- ----- <]>-- ----- ----- ----- .<+++ +[->+ +++<] >++.<"\
-"+++++ +++[- >++++ ++++< ]>+++ +++++ +++++ +++.< +++++ ++++[ ->--- -----"\
-"-<]>- ----- ----- ----- -.<++ +++++ [->++ +++++ <]>++ +++++ +.<++ ++++["\
-"->+++ +++<] >++++ +.<++ +++++ ++[-> ----- ----< ]>--- ----- ----- ----."\
-"<++++ [->++ ++<]> ++.<+ +++++ ++[-> +++++ +++<] >++++ +++++ +++++ ++.<+"\
-"+++++ +++[- >---- ----- <]>-- ----- ----- ----- .<+++ ++++[ ->+++ ++++<"\
-"]>+++ +++++ .<+++ +++[- >++++ ++<]> +++++ .<+++ +++++ +[->- ----- ---<]"\
-">---- ----- ----- ---.< ++++[ ->+++ +<]>+ +.<++ +++++ ++[-> +++++ ++++<"\
-"]>+++ +++++ +++.< +++++ ++[-> ----- --<]> --.<+ +++++ +[->- ----- -<]>-"\
-"----- ----. <", true);
+            run_bf(status, example_program, true);
         } else if (ret == 3) {
-            run_bf(peko, false);
+            fresh_vm(status);
+            if (engine == vm_engine::image) {
+                // compiled on the host at build time, run straight from flash
+                interpret_image(status, peko_image, sizeof(peko_image));
+            } else {
+                interpret_packed(status, peko_packed, sizeof(peko_packed));
+            }
+            printf("\n");
         }
     }
 }
@@ -0,0 +1,149 @@
+#include "brainfuck_bench.h"
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <unordered_set>
+#include "brainfuck_estimate.h"
+#include "brainfuck_ir.h"
+
+#pragma mark - benchmark results
+
+uint64_t median_us(const bench_result & result) {
+    if (result.samples.empty()) {
+        return 1;
+    }
+    std::vector<uint64_t> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+    size_t mid = sorted.size() / 2;
+    uint64_t median = sorted.size() % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2;
+    return std::max<uint64_t>(median, 1);
+}
+
+/**
+ count the loops of a compiled block, including nested ones
+
+ @param block  compiled block
+ @param bodies filled with the distinct loop bodies
+ @return number of loops
+*/
+static size_t count_loops(const brainfuck_block & block, std::unordered_set<const brainfuck_block *> & bodies) {
+    size_t loops = 0;
+    for (const auto & op : block.ops) {
+        if (auto loop = std::get_if<loop_ir>(&op)) {
+            bodies.insert(loop->body.get());
+            loops += 1 + count_loops(*loop->body, bodies);
+        }
+    }
+    return loops;
+}
+
+bench_result run_benchmark(clock_control & clock, const char * name, const char * source, size_t len, unsigned repeats) {
+    size_t source_ops = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (bf_op_map.count(source[i])) {
+            source_ops++;
+        }
+    }
+    return run_benchmark(clock, name, compile_bf(source, len), source_ops, repeats);
+}
+
+bench_result run_benchmark(clock_control & clock, const char * name, std::optional<brainfuck_block> compiled, size_t source_ops, unsigned repeats) {
+    bench_result result;
+    result.name = name;
+    result.optimiser.source_ops = source_ops;
+    if (!compiled) {
+        return result;
+    }
+    result.compiled = true;
+    // compiled once, every run is a fresh vm on the same program
+    std::shared_ptr<const brainfuck_program> program = make_program(std::move(*compiled));
+    count_ir(program->code, result.optimiser.ir_ops, result.optimiser.ir_bytes);
+    std::unordered_set<const brainfuck_block *> bodies;
+    result.optimiser.loops = count_loops(program->code, bodies);
+    result.optimiser.shared_loops = result.optimiser.loops - bodies.size();
+    result.optimiser.closed_form_runs = estimate_cost(program->code).closed_form_loops;
+
+    std::unique_ptr<brainfuck_vm_status> status;
+    for (unsigned run = 0; run < repeats; run++) {
+        status = std::make_unique<brainfuck_vm_status>();
+        // output is hashed, so runs measure the vm alone
+        digest_io io;
+        status->io = &io;
+        result.optimiser.bounded_tape = size_tape_for(*status, *program);
+        load_program(*status, program);
+
+        uint64_t start = clock.now_us();
+        run_compiled(*status);
+        result.samples.push_back(clock.now_us() - start);
+
+        result.instructions = status->instruction_executed;
+        result.output_bytes = io.written;
+        result.output_digest = io.digest;
+    }
+    // every run ends on the same tape, the last one is measured once, whatever the repeat count
+    if (status) {
+        result.memory = memory_report();
+        measure_vm_memory(*status, result.memory);
+    }
+    return result;
+}
+
+/**
+ write a string as a JSON string literal
+
+ @param out  where to write
+ @param text the string
+*/
+static void print_json_string(FILE * out, const std::string & text) {
+    fputc('"', out);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void print_bench_json(FILE * out, const char * platform, uint32_t khz, const std::vector<bench_result> & results) {
+    fprintf(out, "{\n  \"schema\": %d,\n  \"platform\": ", BRAINFUCK_BENCH_SCHEMA);
+    print_json_string(out, platform);
+    fprintf(out, ",\n  \"khz\": %lu,\n  \"programs\": [", (unsigned long)khz);
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result & result = results[i];
+        uint64_t median = median_us(result);
+        fprintf(out, "%s\n    {\n      \"name\": ", i ? "," : "");
+        print_json_string(out, result.name);
+        fprintf(out, ",\n      \"compiled\": %s,\n", result.compiled ? "true" : "false");
+        fprintf(out, "      \"instructions\": %llu,\n", (unsigned long long)result.instructions);
+        fprintf(out, "      \"output_bytes\": %llu,\n", (unsigned long long)result.output_bytes);
+        fprintf(out, "      \"output_digest\": \"%016llx\",\n", (unsigned long long)result.output_digest);
+        fprintf(out, "      \"wall_us\": %llu,\n", (unsigned long long)median);
+        fprintf(out, "      \"ops_per_sec\": %llu,\n", (unsigned long long)(result.instructions * 1000000 / median));
+        fprintf(out, "      \"samples_us\": [");
+        for (size_t j = 0; j < result.samples.size(); j++) {
+            fprintf(out, "%s%llu", j ? ", " : "", (unsigned long long)result.samples[j]);
+        }
+        fprintf(out, "],\n");
+        // the heap is only known where the platform measured it, a host leaves it out
+        fprintf(out, "      \"memory\": {");
+        if (result.memory.heap_total > 0) {
+            fprintf(out, "\"heap_peak\": %lu, ", (unsigned long)result.memory.heap_peak);
+        }
+        fprintf(out, "\"tape_bytes\": %lu, \"ir_bytes\": %lu},\n",
+                (unsigned long)result.memory.tape_bytes,
+                (unsigned long)result.memory.instruction_capacity);
+        fprintf(out, "      \"optimiser\": {\"source_ops\": %lu, \"ir_ops\": %lu, \"loops\": %lu, \"shared_loops\": %lu, "
+                     "\"closed_form_runs\": %lu, \"bounded_tape\": %s}\n    }",
+                (unsigned long)result.optimiser.source_ops,
+                (unsigned long)result.optimiser.ir_ops,
+                (unsigned long)result.optimiser.loops,
+                (unsigned long)result.optimiser.shared_loops,
+                (unsigned long)result.optimiser.closed_form_runs,
+                result.optimiser.bounded_tape ? "true" : "false");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+#include "brainfuck_clock.h"
+#include "brainfuck_diag.h"
+#include "brainfuck_ir.h"
+
+/// version of the JSON written by print_bench_json, bumped on incompatible changes
+#define BRAINFUCK_BENCH_SCHEMA 1
+
+#pragma mark - benchmark results
+
+/// what the compiler made of a program
+struct optimiser_stats {
+    /// brainfuck ops in the source
+    size_t source_ops = 0;
+    /// compiled ops, including nested loop bodies
+    size_t ir_ops = 0;
+    /// bytes taken by the compiled program
+    size_t ir_bytes = 0;
+    /// loops in the compiled program
+    size_t loops = 0;
+    /// loops reusing the compiled body of an identical loop
+    size_t shared_loops = 0;
+    /// loop runs the estimator evaluates in closed form instead of stepping through them
+    uint32_t closed_form_runs = 0;
+    /// whether static analysis could size the tape
+    bool bounded_tape = false;
+};
+
+/// one program measured by run_benchmark
+struct bench_result {
+    std::string name;
+    /// the program compiled, `samples` is empty otherwise
+    bool compiled = false;
+    /// compiled ops and loop tests executed by one run
+    uint64_t instructions = 0;
+    /// bytes written by one run
+    uint64_t output_bytes = 0;
+    /// FNV-1a of the output of one run
+    uint64_t output_digest = BRAINFUCK_DIGEST_OFFSET;
+    /// wall time of every run in microseconds
+    std::vector<uint64_t> samples;
+    /// tape and instruction part filled in by the benchmark from one run, the heap by the platform
+    /// if it can, heap_total stays 0 otherwise
+    memory_report memory;
+    optimiser_stats optimiser;
+};
+
+/**
+ median of the wall time samples
+
+ @param result benchmark result
+ @return median wall time in microseconds, at least 1
+*/
+uint64_t median_us(const bench_result & result);
+
+/**
+ compile a program and run it `repeats` times on the compiled engine with a fresh vm each time,
+ output only feeds a digest_io, input reads as 0
+
+ @param clock   clock used for timing
+ @param name    name of the program in the report
+ @param source  brainfuck source
+ @param len     length of source
+ @param repeats number of timed runs
+ @return bench_result
+*/
+bench_result run_benchmark(clock_control & clock, const char * name, const char * source, size_t len, unsigned repeats);
+
+/**
+ run_benchmark on a program compiled elsewhere, e.g. by compile_packed
+
+ @param clock      clock used for timing
+ @param name       name of the program in the report
+ @param compiled   the compiled program, std::nullopt if it did not compile
+ @param source_ops brainfuck ops in the source
+ @param repeats    number of timed runs
+ @return bench_result
+*/
+bench_result run_benchmark(clock_control & clock, const char * name, std::optional<brainfuck_block> compiled, size_t source_ops, unsigned repeats);
+
+/**
+ write benchmark results as JSON
+
+ @param out      where to write
+ @param platform where the benchmark ran, e.g. "rp2040" or "host"
+ @param khz      system clock during the runs, 0 if unknown
+ @param results  benchmark results
+*/
+void print_bench_json(FILE * out, const char * platform, uint32_t khz, const std::vector<bench_result> & results);
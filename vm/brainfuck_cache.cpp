@@ -0,0 +1,136 @@
+#include "brainfuck_cache.h"
+#include <cstring>
+#include "brainfuck_image.h"
+#include "brainfuck_io.h"
+
+/**
+ FNV-1a of some bytes
+
+ @param bytes the bytes
+ @param len   number of bytes
+ @return the hash
+*/
+static uint64_t fnv1a(const uint8_t * bytes, size_t len) {
+    uint64_t hash = BRAINFUCK_DIGEST_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * BRAINFUCK_DIGEST_PRIME;
+    }
+    return hash;
+}
+
+/**
+ bytes an entry takes, header and padding included
+
+ @param len length of its image
+ @return the size
+*/
+static size_t entry_size(size_t len) {
+    return (sizeof(cache_entry) + len + BRAINFUCK_CACHE_ALIGN - 1) / BRAINFUCK_CACHE_ALIGN * BRAINFUCK_CACHE_ALIGN;
+}
+
+/**
+ visit the entries of a region in order
+
+ @param storage the region
+ @param visit   called with every entry and its image
+ @return offset of the erased space after the last entry, or the size of the region if
+         what follows is neither an entry nor erased
+*/
+template <typename Visit>
+static size_t walk_entries(const cache_storage & storage, Visit visit) {
+    const uint8_t * region = storage.data();
+    size_t offset = 0;
+    while (offset + sizeof(cache_entry) <= storage.size()) {
+        const cache_entry * entry = reinterpret_cast<const cache_entry *>(region + offset);
+        if (entry->magic != BRAINFUCK_CACHE_MAGIC) {
+            return entry->magic == UINT32_MAX ? offset : storage.size();
+        }
+        if (entry->len > storage.size() - offset - sizeof(cache_entry)) {
+            return storage.size();
+        }
+        visit(*entry, region + offset + sizeof(cache_entry));
+        offset += entry_size(entry->len);
+    }
+    return storage.size();
+}
+
+/**
+ whether an entry holds the image it was written with
+
+ @param entry the entry
+ @param image its image
+ @return whether the check matches
+*/
+static bool entry_intact(const cache_entry & entry, const uint8_t * image) {
+    return entry.check == uint32_t(fnv1a(image, entry.len));
+}
+
+uint64_t key_source(const char * source, size_t len, uint32_t & ops) {
+    uint64_t hash = BRAINFUCK_DIGEST_OFFSET;
+    ops = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = source[i];
+        if (c && strchr("+-<>.,[]", c)) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * BRAINFUCK_DIGEST_PRIME;
+            ops++;
+        }
+    }
+    return hash;
+}
+
+const void * image_cache::find(uint64_t program, size_t & len) const {
+    const void * found = nullptr;
+    walk_entries(storage, [&](const cache_entry & entry, const uint8_t * image) {
+        if (found || entry.build_id != build_id || entry.program != program || !entry_intact(entry, image)) {
+            return;
+        }
+        // hashes only catch accidents, the image is still verified before it runs
+        if (verify_image(image, entry.len) == nullptr) {
+            found = image;
+            len = entry.len;
+        }
+    });
+    return found;
+}
+
+bool image_cache::store(uint64_t program, const std::vector<uint32_t> & image) {
+    size_t len = image.size() * sizeof(uint32_t);
+    std::vector<uint8_t> record(entry_size(len), 0xff);
+    cache_entry entry = {};
+    entry.magic = BRAINFUCK_CACHE_MAGIC;
+    entry.build_id = build_id;
+    entry.program = program;
+    entry.len = uint32_t(len);
+    entry.check = uint32_t(fnv1a(reinterpret_cast<const uint8_t *>(image.data()), len));
+    memcpy(record.data(), &entry, sizeof(entry));
+    memcpy(record.data() + sizeof(entry), image.data(), len);
+    if (record.size() > storage.size()) {
+        return false;
+    }
+
+    cache_stats current = stats();
+    size_t offset = current.used;
+    if (current.stale > 0 || offset + record.size() > storage.size()) {
+        // no eviction of single entries, the log starts over
+        storage.erase();
+        offset = 0;
+    }
+    storage.program(offset, record.data(), record.size());
+    return true;
+}
+
+void image_cache::clear() {
+    storage.erase();
+}
+
+cache_stats image_cache::stats() const {
+    cache_stats stats;
+    stats.used = walk_entries(storage, [&](const cache_entry & entry, const uint8_t * image) {
+        if (entry.build_id == build_id && entry_intact(entry, image)) {
+            stats.entries++;
+        } else {
+            stats.stale++;
+        }
+    });
+    return stats;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// "BFC1", start of a cache entry
+#define BRAINFUCK_CACHE_MAGIC 0x31434642u
+/// entries start on a flash page, the unit the RP2040 flash is programmed in
+#define BRAINFUCK_CACHE_ALIGN 256
+
+#pragma mark - image cache
+
+// the cache is a log of entries in a region of flash, each a cache_entry followed by an image
+// and padded to a page; a new entry is programmed into the erased space after the last one,
+// and the whole region is erased once it is full or holds entries of another firmware build
+//
+// a cache hit is an image in flash that runs in place, nothing is compiled
+
+/// header of a cached image
+struct cache_entry {
+    uint32_t magic;
+    /// firmware build the image was cached by
+    uint32_t build_id;
+    /// key_source of the program
+    uint64_t program;
+    /// length of the image following the header, in bytes
+    uint32_t len;
+    /// low half of the FNV-1a of the image, an entry cut short by a reset does not match
+    uint32_t check;
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(cache_entry) == 32, "images after the header must stay 4-byte aligned");
+
+/// the memory behind the cache, the firmware programs flash, a host can back it with RAM
+struct cache_storage {
+    virtual ~cache_storage() = default;
+
+    /// the region, readable in place
+    virtual const uint8_t * data() const = 0;
+    /// length of the region, a multiple of BRAINFUCK_CACHE_ALIGN
+    virtual size_t size() const = 0;
+    /// set the whole region to 0xff
+    virtual void erase() = 0;
+    /// write erased bytes, offset and len are multiples of BRAINFUCK_CACHE_ALIGN
+    virtual void program(size_t offset, const uint8_t * bytes, size_t len) = 0;
+};
+
+/// what is in a cache
+struct cache_stats {
+    /// entries of this build
+    uint32_t entries = 0;
+    /// entries of other builds or cut short, dropped by the next store
+    uint32_t stale = 0;
+    /// bytes taken, entries of any build
+    size_t used = 0;
+};
+
+/**
+ key of a program in the cache, FNV-1a of its commands, so comments and layout do not matter
+
+ @param source brainfuck source
+ @param len    length of source
+ @param ops    set to the number of commands
+ @return the key
+*/
+uint64_t key_source(const char * source, size_t len, uint32_t & ops);
+
+/// compiled images of programs, kept across resets
+struct image_cache {
+    /**
+     @param storage  region the entries are kept in
+     @param build_id identifies the firmware, entries of any other build are never used
+    */
+    image_cache(cache_storage & storage, uint32_t build_id) : storage(storage), build_id(build_id) {}
+
+    /**
+     look a program up, the image is checked against its entry and verified
+
+     @param program key_source of the program
+     @param len     set to the length of the image
+     @return the image in place in the storage, or nullptr
+    */
+    const void * find(uint64_t program, size_t & len) const;
+
+    /**
+     add the image of a program, erasing the region first if it is full or stale
+
+     @param program key_source of the program
+     @param image   the image
+     @return whether it was stored, it is not if it is larger than the whole region
+    */
+    bool store(uint64_t program, const std::vector<uint32_t> & image);
+
+    /// drop every entry
+    void clear();
+
+    /**
+     count the entries
+
+     @return cache_stats
+    */
+    cache_stats stats() const;
+
+    cache_storage & storage;
+    uint32_t build_id;
+};
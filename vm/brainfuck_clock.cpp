@@ -0,0 +1,72 @@
+#include "brainfuck_clock.h"
+#include <cstdio>
+#include <cstring>
+#include "brainfuck_ir.h"
+
+#pragma mark - clock scaling
+
+core_voltage voltage_for_khz(uint32_t khz) {
+    if (khz <= 133000) return core_voltage::v1_10;
+    if (khz <= 200000) return core_voltage::v1_15;
+    if (khz <= 250000) return core_voltage::v1_20;
+    if (khz <= 280000) return core_voltage::v1_25;
+    return core_voltage::v1_30;
+}
+
+bool scale_clock(clock_control & clock, uint32_t khz) {
+    if (khz == 0 || khz > BRAINFUCK_CLOCK_MAX_KHZ || !clock.can_set_khz(khz)) {
+        return false;
+    }
+
+    uint32_t current = clock.get_khz();
+    if (current == khz) {
+        return true;
+    }
+
+    core_voltage from = voltage_for_khz(current);
+    core_voltage to = voltage_for_khz(khz);
+    if (khz > current) {
+        // speeding up, the core needs the higher voltage first
+        if (to != from) clock.set_voltage(to);
+        if (!clock.set_khz(khz)) {
+            if (to != from) clock.set_voltage(from);
+            return false;
+        }
+    } else {
+        // slowing down, keep the voltage until the clock is lower
+        if (!clock.set_khz(khz)) {
+            return false;
+        }
+        if (to != from) clock.set_voltage(to);
+    }
+    return true;
+}
+
+#pragma mark - benchmark
+
+const char * clock_benchmark_kernel = "++++++++[>++++++++[>++++++++[>++++++++[>++++++++[-]<-]<-]<-]<-]";
+
+void run_clock_benchmark(clock_control & clock, const uint32_t * khz, size_t count) {
+    uint32_t original = clock.get_khz();
+    std::shared_ptr<const brainfuck_program> kernel = compile_program(clock_benchmark_kernel, strlen(clock_benchmark_kernel));
+    for (size_t i = 0; i < count; i++) {
+        if (!scale_clock(clock, khz[i])) {
+            printf("%6lu kHz: not available\n", (unsigned long)khz[i]);
+            continue;
+        }
+
+        brainfuck_vm_status status;
+        load_program(status, kernel);
+        uint64_t start = clock.now_us();
+        run_compiled(status);
+        uint64_t elapsed = clock.now_us() - start;
+        if (elapsed == 0) elapsed = 1;
+
+        printf("%6lu kHz: %llu ops in %llu us, %llu ops/s\n",
+               (unsigned long)khz[i],
+               (unsigned long long)status.instruction_executed,
+               (unsigned long long)elapsed,
+               (unsigned long long)(status.instruction_executed * 1000000 / elapsed));
+    }
+    scale_clock(clock, original);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// system clock the sdk boots with, in kHz
+#define BRAINFUCK_CLOCK_NORMAL_KHZ 125000
+/// system clock used for compute-heavy runs, in kHz
+#define BRAINFUCK_CLOCK_BOOST_KHZ 250000
+/// highest system clock we are willing to set, in kHz,
+/// boot2 runs the QSPI flash at half the system clock and the flash tops out at 133 MHz
+#define BRAINFUCK_CLOCK_MAX_KHZ 266000
+
+#pragma mark - clock scaling
+
+/// core voltage levels, same order as `enum vreg_voltage` from the sdk
+enum class core_voltage {
+    v1_10,
+    v1_15,
+    v1_20,
+    v1_25,
+    v1_30
+};
+
+/// the system clock as seen by the VM
+/// the firmware drives the RP2040 clocks, host tests can substitute a mock
+struct clock_control {
+    virtual ~clock_control() = default;
+
+    /// current system clock in kHz
+    virtual uint32_t get_khz() const = 0;
+    /// whether the PLL can generate exactly `khz`
+    virtual bool can_set_khz(uint32_t khz) const = 0;
+    /// reprogram the system clock, the voltage must already be sufficient
+    virtual bool set_khz(uint32_t khz) = 0;
+    /// set the core voltage and wait until it is stable
+    virtual void set_voltage(core_voltage voltage) = 0;
+    /// microseconds since boot, not affected by the system clock
+    virtual uint64_t now_us() const = 0;
+};
+
+/**
+ lowest core voltage that keeps the RP2040 stable at the given clock
+
+ @param khz system clock in kHz
+ @return core_voltage
+*/
+core_voltage voltage_for_khz(uint32_t khz);
+
+/**
+ change the system clock, raising the core voltage before speeding up
+ and lowering it only after slowing down
+
+ @param clock the clock to scale
+ @param khz   target system clock in kHz
+ @return whether the clock is now running at `khz`
+*/
+bool scale_clock(clock_control & clock, uint32_t khz);
+
+#pragma mark - benchmark
+
+/// compute-only brainfuck program used by the benchmark, no I/O
+extern const char * clock_benchmark_kernel;
+
+/**
+ run the benchmark kernel at every given clock and report instructions per second,
+ the original clock is restored afterwards
+
+ @param clock clock to scale
+ @param khz   list of clocks in kHz
+ @param count number of clocks in `khz`
+*/
+void run_clock_benchmark(clock_control & clock, const uint32_t * khz, size_t count);
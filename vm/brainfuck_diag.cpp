@@ -0,0 +1,200 @@
+#include "brainfuck_diag.h"
+#include <algorithm>
+#include <cstdio>
+#include <unordered_set>
+#include "brainfuck_ir.h"
+
+#pragma mark - execution trace
+
+#if BRAINFUCK_VM_TRACE
+std::array<trace_event, 1 << BRAINFUCK_VM_TRACE_LOG2> trace_ring;
+uint32_t trace_count = 0;
+bool trace_enabled = false;
+
+void trace_record(brainfuck_vm_status & status, int pc, char op) {
+    trace_event & event = trace_ring[trace_count & (trace_ring.size() - 1)];
+    event.pc = pc;
+    event.tape_ptr = status.tape_ptr;
+    event.op = op;
+    event.value = tape_cell(status);
+    trace_count++;
+}
+
+void print_trace(uint32_t count) {
+    count = std::min<uint32_t>({count, trace_count, uint32_t(trace_ring.size())});
+    for (uint32_t seq = trace_count - count; seq != trace_count; seq++) {
+        const trace_event & event = trace_ring[seq & (trace_ring.size() - 1)];
+        printf("#%lu pc=%d op=%c ptr=%d cell=%d\n",
+               (unsigned long)seq, event.pc, event.op, event.tape_ptr, (unsigned char)event.value);
+    }
+}
+#endif
+
+#pragma mark - tape profile
+
+bool profile_enabled = false;
+tape_profile profile;
+
+void profile_access(const brainfuck_vm_status & status, uint32_t reads, uint32_t writes) {
+    profile.ptr_min = std::min(profile.ptr_min, status.tape_ptr);
+    profile.ptr_max = std::max(profile.ptr_max, status.tape_ptr);
+
+    uint32_t window = uint32_t(status.instruction_executed >> profile.window_log2);
+    if (window != profile.window) {
+        // close the current window, windows without any access are empty
+        profile.working_set.emplace_back(profile.window_blocks);
+        profile.working_set.resize(profile.working_set.size() + (window - profile.window - 1), 0);
+        profile.window = window;
+        profile.window_blocks = 0;
+        while (profile.working_set.size() >= BRAINFUCK_VM_PROFILE_WINDOWS) {
+            // too many samples, merge neighbours into windows twice as long
+            size_t merged = (profile.working_set.size() + 1) / 2;
+            for (size_t i = 0; i < merged; i++) {
+                uint32_t odd = 2 * i + 1 < profile.working_set.size() ? profile.working_set[2 * i + 1] : 0;
+                profile.working_set[i] = std::max(profile.working_set[2 * i], odd);
+            }
+            profile.working_set.resize(merged);
+            profile.window_log2++;
+            profile.window = uint32_t(status.instruction_executed >> profile.window_log2);
+            for (auto & block : profile.blocks) {
+                block.second.window = UINT32_MAX;
+            }
+        }
+    }
+
+    tape_block_profile & block = profile.blocks[status.tape_ptr >> BRAINFUCK_VM_PROFILE_BLOCK_LOG2];
+    block.reads += reads;
+    block.writes += writes;
+    if (block.window != profile.window) {
+        block.window = profile.window;
+        profile.window_blocks++;
+    }
+}
+
+void start_profile(const brainfuck_vm_status & status) {
+    profile = tape_profile();
+    profile.window = uint32_t(status.instruction_executed >> profile.window_log2);
+}
+
+void print_tape_profile() {
+    if (profile.blocks.empty()) {
+        printf("profile: no tape access recorded\n");
+        return;
+    }
+
+    const int block_len = 1 << BRAINFUCK_VM_PROFILE_BLOCK_LOG2;
+    printf("tape: ptr [%d, %d], %lu blocks of %d cells touched\n",
+           profile.ptr_min, profile.ptr_max, (unsigned long)profile.blocks.size(), block_len);
+
+    // glyphs by log2 of the access count, relative to the hottest block
+    static const char glyphs[] = " .:-=+*#%@";
+    uint32_t hottest = 0;
+    for (const auto & block : profile.blocks) {
+        hottest = std::max(hottest, block.second.reads + block.second.writes);
+    }
+    int hottest_log2 = 32 - __builtin_clz(hottest);
+
+    int first = profile.blocks.begin()->first;
+    int last = profile.blocks.rbegin()->first;
+    const int row_len = 64;
+    for (int row = first; row <= last; row += row_len) {
+        printf("%8d |", row * block_len);
+        for (int index = row; index < row + row_len && index <= last; index++) {
+            auto block = profile.blocks.find(index);
+            if (block == profile.blocks.end()) {
+                putchar(' ');
+                continue;
+            }
+            uint32_t count = block->second.reads + block->second.writes;
+            int level = (32 - __builtin_clz(count)) * (int(sizeof(glyphs)) - 2) / hottest_log2;
+            putchar(glyphs[std::max(level, 1)]);
+        }
+        printf("|\n");
+    }
+
+    auto hot = std::max_element(profile.blocks.begin(), profile.blocks.end(), [](const auto & a, const auto & b) {
+        return a.second.reads + a.second.writes < b.second.reads + b.second.writes;
+    });
+    printf("hottest: cells [%d, %d], %lu reads, %lu writes\n",
+           hot->first * block_len, hot->first * block_len + block_len - 1,
+           (unsigned long)hot->second.reads, (unsigned long)hot->second.writes);
+
+    std::vector<uint32_t> working_set = profile.working_set;
+    working_set.emplace_back(profile.window_blocks);
+    printf("working set, blocks per %lu ops:", (unsigned long)1 << profile.window_log2);
+    for (uint32_t blocks : working_set) {
+        printf(" %lu", (unsigned long)blocks);
+    }
+    uint32_t peak = *std::max_element(working_set.begin(), working_set.end());
+    printf("\npeak working set: %lu blocks, %lu cells\n", (unsigned long)peak, (unsigned long)peak * block_len);
+}
+
+#pragma mark - memory diagnostics
+
+/**
+ count_ir of the blocks not counted yet
+
+ @param block   compiled block
+ @param ops     incremented by the number of ops
+ @param bytes   incremented by the number of bytes
+ @param counted blocks already counted, loop bodies are shared
+*/
+static void count_ir_once(const brainfuck_block & block, size_t & ops, size_t & bytes, std::unordered_set<const brainfuck_block *> & counted) {
+    if (!counted.insert(&block).second) {
+        return;
+    }
+    ops += block.ops.size();
+    bytes += sizeof(brainfuck_block) + block.ops.capacity() * sizeof(brainfuck_ir) + block.run_cost.capacity() * sizeof(uint32_t);
+    for (const auto & op : block.ops) {
+        if (auto loop = std::get_if<loop_ir>(&op)) {
+            count_ir_once(*loop->body, ops, bytes, counted);
+        }
+    }
+}
+
+void count_ir(const brainfuck_block & block, size_t & ops, size_t & bytes) {
+    std::unordered_set<const brainfuck_block *> counted;
+    count_ir_once(block, ops, bytes, counted);
+}
+
+void measure_vm_memory(const brainfuck_vm_status & status, memory_report & report) {
+    if (status.mode == tape_mode::ring) {
+        report.tape_min = 0;
+        report.tape_max = int(status.ring.size()) - 1;
+        report.tape_bytes = status.ring.capacity();
+    } else if (status.mode == tape_mode::bounded) {
+        report.tape_min = status.bounded_base;
+        report.tape_max = status.bounded_base + int(status.bounded.size()) - 1;
+        report.tape_bytes = status.bounded.capacity();
+    } else {
+        const int page_len = 1 << BRAINFUCK_VM_TAPE_PAGE_LOG2;
+        report.tape_min = -int(status.tape.backward.size()) * page_len;
+        report.tape_max = int(status.tape.forward.size()) * page_len - 1;
+        report.tape_bytes = (status.tape.forward.capacity() + status.tape.backward.capacity()) * sizeof(std::unique_ptr<tape_page>);
+        for (const auto * pages : {&status.tape.forward, &status.tape.backward}) {
+            for (const auto & page : *pages) {
+                if (page) report.tape_bytes += sizeof(tape_page);
+            }
+        }
+    }
+
+    if (status.program) {
+        count_ir(*status.program, report.instruction_size, report.instruction_capacity);
+    } else if (status.reference) {
+        report.instruction_size = status.reference->instruction.size();
+        report.instruction_capacity = status.reference->instruction.capacity();
+    }
+}
+
+void print_memory_report(const memory_report & report) {
+    printf("heap: %lu B in use, %lu B peak of %lu B\n",
+           (unsigned long)report.heap_in_use, (unsigned long)report.heap_peak, (unsigned long)report.heap_total);
+    for (int core = 0; core < 2; core++) {
+        printf("stack core%d: %lu B peak of %lu B%s\n", core,
+               (unsigned long)report.stack[core].peak, (unsigned long)report.stack[core].size,
+               report.stack[core].overflowed ? " (overflowed)" : "");
+    }
+    printf("tape: cells [%d, %d], %lu B\n", report.tape_min, report.tape_max, (unsigned long)report.tape_bytes);
+    printf("instructions: %lu ops, %lu B buffer\n",
+           (unsigned long)report.instruction_size, (unsigned long)report.instruction_capacity);
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <climits>
+#include <array>
+#include <map>
+#include <vector>
+#include "brainfuck_vm.h"
+
+/// record loop back-edges and I/O into a ring buffer, 0 compiles the trace out entirely
+#ifndef BRAINFUCK_VM_TRACE
+#define BRAINFUCK_VM_TRACE 0
+#endif
+/// log2 of the number of events kept by the trace
+#define BRAINFUCK_VM_TRACE_LOG2 8
+
+/// log2 of the number of cells counted together by the tape profile
+#define BRAINFUCK_VM_PROFILE_BLOCK_LOG2 6
+/// number of working set samples kept, windows are widened to stay within it
+#define BRAINFUCK_VM_PROFILE_WINDOWS 64
+
+struct brainfuck_block;
+
+#pragma mark - execution trace
+
+/// one event of the execution trace
+struct trace_event {
+    /// instruction index of the op
+    int pc;
+    /// tape pointer when the op ran
+    int tape_ptr;
+    /// the op, `]` for a loop back-edge, `.` or `,` for I/O
+    char op;
+    /// cell value after the op
+    char value;
+};
+
+#if BRAINFUCK_VM_TRACE
+/// the last 2^BRAINFUCK_VM_TRACE_LOG2 events
+extern std::array<trace_event, 1 << BRAINFUCK_VM_TRACE_LOG2> trace_ring;
+/// number of events ever recorded, the next one goes to `trace_count & mask`
+extern uint32_t trace_count;
+/// toggled at runtime by the `trace` REPL command
+extern bool trace_enabled;
+
+/**
+ append an event to the execution trace
+
+ @param status the brainfuck vm status
+ @param pc     instruction index of the op
+ @param op     the op being traced
+*/
+void trace_record(brainfuck_vm_status & status, int pc, char op);
+
+/**
+ print the last events of the execution trace, oldest first
+
+ @param count number of events
+*/
+void print_trace(uint32_t count);
+
+/// trace an op if tracing is on, a single well predicted branch when it is off
+#define BRAINFUCK_TRACE(status, pc, op) do { if (__builtin_expect(trace_enabled, 0)) trace_record(status, pc, op); } while (0)
+#else
+#define BRAINFUCK_TRACE(status, pc, op) do {} while (0)
+#endif
+
+#pragma mark - tape profile
+
+/// accesses to one block of 2^BRAINFUCK_VM_PROFILE_BLOCK_LOG2 cells
+struct tape_block_profile {
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    /// last working set window the block was touched in
+    uint32_t window = UINT32_MAX;
+};
+
+/// tape accesses of a run
+struct tape_profile {
+    /// per block counters, keyed by cell index >> BRAINFUCK_VM_PROFILE_BLOCK_LOG2
+    std::map<int, tape_block_profile> blocks;
+    /// lowest and highest cell accessed
+    int ptr_min = INT_MAX;
+    int ptr_max = INT_MIN;
+
+    /// log2 of the number of executed ops per working set window
+    unsigned window_log2 = 10;
+    /// current window
+    uint32_t window = 0;
+    /// distinct blocks touched in the current window
+    uint32_t window_blocks = 0;
+    /// distinct blocks touched in each finished window
+    std::vector<uint32_t> working_set;
+};
+
+/// toggled at runtime by the `profile` REPL command
+extern bool profile_enabled;
+/// profile of the last run
+extern tape_profile profile;
+
+/**
+ record a tape access at the tape pointer
+
+ @param status the brainfuck vm status
+ @param reads  number of reads
+ @param writes number of writes
+*/
+void profile_access(const brainfuck_vm_status & status, uint32_t reads, uint32_t writes);
+
+/**
+ start a fresh tape profile for a run
+
+ @param status the brainfuck vm status about to run
+*/
+void start_profile(const brainfuck_vm_status & status);
+
+/**
+ print the tape profile of the last run as a heatmap with one glyph per block,
+ followed by the working set over time
+*/
+void print_tape_profile();
+
+/// profile a tape access if profiling is on, a single well predicted branch when it is off
+#define BRAINFUCK_PROFILE(status, reads, writes) do { if (__builtin_expect(profile_enabled, 0)) profile_access(status, reads, writes); } while (0)
+
+#pragma mark - memory diagnostics
+
+/// stack usage of one core
+struct stack_usage {
+    /// size of the stack region in bytes
+    uint32_t size = 0;
+    /// deepest the stack has ever been, in bytes
+    uint32_t peak = 0;
+    /// the lowest word of the region has been written
+    bool overflowed = false;
+};
+
+/// memory usage of the firmware and the brainfuck vm
+struct memory_report {
+    /// bytes allocated on the heap right now
+    uint32_t heap_in_use = 0;
+    /// bytes the heap has ever grown to
+    uint32_t heap_peak = 0;
+    /// bytes available to the heap
+    uint32_t heap_total = 0;
+    /// core 0 and core 1
+    stack_usage stack[2];
+
+    /// lowest and highest cell with storage on the tape
+    int tape_min = 0;
+    int tape_max = -1;
+    /// bytes used by the tape
+    size_t tape_bytes = 0;
+
+    /// number of recorded instructions, or compiled ops
+    size_t instruction_size = 0;
+    /// bytes reserved for recorded instructions, or taken by the compiled program
+    size_t instruction_capacity = 0;
+};
+
+/**
+ count the ops of a compiled block and the bytes it takes, including nested loops,
+ a loop body shared by several loops is counted once
+
+ @param block compiled block
+ @param ops   incremented by the number of ops
+ @param bytes incremented by the number of bytes
+*/
+void count_ir(const brainfuck_block & block, size_t & ops, size_t & bytes);
+
+/**
+ fill in the tape and instruction part of a memory_report,
+ the heap and the stacks are up to the platform
+
+ @param status the brainfuck vm status
+ @param report the report
+*/
+void measure_vm_memory(const brainfuck_vm_status & status, memory_report & report);
+
+/**
+ print a memory_report
+
+ @param report the report
+*/
+void print_memory_report(const memory_report & report);
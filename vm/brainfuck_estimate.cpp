@@ -0,0 +1,281 @@
+#include "brainfuck_estimate.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#pragma mark - cost estimation
+
+/// scratch machine the estimator runs the program on
+struct cost_machine {
+    paged_tape tape;
+    int ptr = 0;
+    /// lowest and highest cell touched since the loop iteration being sampled began
+    int lo = 0;
+    int hi = 0;
+};
+
+/// one sampled iteration of a loop
+struct loop_sample {
+    /// cells the iteration touched
+    int lo = 0;
+    int hi = 0;
+    /// compiled ops it cost, its loop test included
+    uint64_t ops = 0;
+    /// ops of it that were stepped through rather than projected
+    uint64_t sampled_ops = 0;
+    /// it started and ended on the loop counter within BRAINFUCK_ESTIMATE_WINDOW cells
+    bool same_shape = false;
+    /// change of every cell from `lo` to `hi`, if the iteration before touched the same cells
+    bool measured = false;
+    std::vector<signed char> deltas;
+};
+
+/**
+ add ops to the estimate, saturating rather than wrapping for programs far too long to ever run
+
+ @param estimate the estimate to add to
+ @param ops      ops to add
+*/
+static void add_ops(cost_estimate & estimate, double ops) {
+    double total = double(estimate.ops) + ops;
+    estimate.ops = total >= 18446744073709551615.0 ? UINT64_MAX : uint64_t(total);
+}
+
+/**
+ widen the touched window of the machine to a cell
+
+ @param machine scratch machine
+ @param cell    cell touched
+*/
+static void touch(cost_machine & machine, int cell) {
+    machine.lo = std::min(machine.lo, cell);
+    machine.hi = std::max(machine.hi, cell);
+}
+
+static void estimate_block(const brainfuck_block & block, cost_machine & machine, cost_estimate & estimate);
+
+/**
+ evaluate a loop whose body only adds and moves and leaves the pointer where it was,
+ e.g. `[->++<]`, without iterating it
+
+ @param body    loop body
+ @param machine scratch machine
+ @param estimate the estimate to add to
+ @return false if the loop is not of that shape
+*/
+static bool estimate_closed_form(const brainfuck_block & body, cost_machine & machine, cost_estimate & estimate) {
+    int offset = 0;
+    int step = 0;
+    for (const auto & op : body.ops) {
+        if (auto add = std::get_if<add_ir>(&op)) {
+            if (offset == 0) step += add->delta;
+        } else if (auto move = std::get_if<move_ir>(&op)) {
+            offset += move->delta;
+        } else {
+            return false;
+        }
+    }
+    if (offset != 0) {
+        return false;
+    }
+
+    // the loop runs until the counter cell wraps to 0, at most 256 iterations of `step` apart
+    unsigned char counter = paged_cell(machine.tape, machine.ptr);
+    uint32_t iterations = 0;
+    while (iterations < 256 && (unsigned char)(counter + iterations * step) != 0) {
+        iterations++;
+    }
+    if (iterations == 256) {
+        estimate.diverges = true;
+        return true;
+    }
+
+    // apply every add `iterations` times at once
+    offset = 0;
+    for (const auto & op : body.ops) {
+        if (auto add = std::get_if<add_ir>(&op)) {
+            paged_cell(machine.tape, machine.ptr + offset) += char(add->delta * int(iterations));
+            touch(machine, machine.ptr + offset);
+        } else if (auto move = std::get_if<move_ir>(&op)) {
+            offset += move->delta;
+        }
+    }
+    add_ops(estimate, double(iterations) * body.ops.size() + iterations + 1);
+    estimate.closed_form_loops++;
+    return true;
+}
+
+/**
+ sample a loop by running it, once its iterations change the tape the same way
+ BRAINFUCK_ESTIMATE_LOOP_SAMPLES times in a row and running the rest would overrun the
+ sample budget, the remaining iterations are projected instead: every touched cell moves on
+ by its per-iteration change until the counter wraps to 0, and the cost grows along the
+ trend of the last two iterations
+
+ @param body    loop body
+ @param machine scratch machine, the pointer on a non-zero counter
+ @param estimate the estimate to add to
+*/
+static void sample_loop(const brainfuck_block & body, cost_machine & machine, cost_estimate & estimate) {
+    const int entry = machine.ptr;
+    const int outer_lo = machine.lo;
+    const int outer_hi = machine.hi;
+    int lo = entry;
+    int hi = entry;
+    loop_sample last;
+    uint32_t repeats = 0;
+    std::vector<char> before;
+
+    while (paged_cell(machine.tape, machine.ptr) != 0 && !estimate.truncated && !estimate.diverges) {
+        // the cells the previous iteration touched, to see how this one changes them
+        before.clear();
+        if (machine.ptr == entry && last.same_shape) {
+            for (int cell = last.lo; cell <= last.hi; cell++) {
+                before.push_back(paged_cell(machine.tape, cell));
+            }
+        }
+        loop_sample sample;
+        uint64_t ops = estimate.ops;
+        uint64_t sampled_ops = estimate.sampled_ops;
+        machine.lo = machine.hi = machine.ptr;
+        estimate.ops++;
+        estimate.sampled_ops++;
+        estimate_block(body, machine, estimate);
+        sample.lo = machine.lo;
+        sample.hi = machine.hi;
+        sample.ops = estimate.ops - ops;
+        sample.sampled_ops = estimate.sampled_ops - sampled_ops;
+        lo = std::min(lo, sample.lo);
+        hi = std::max(hi, sample.hi);
+        if (estimate.truncated || estimate.diverges) {
+            break;
+        }
+
+        sample.same_shape = machine.ptr == entry && sample.hi - sample.lo < BRAINFUCK_ESTIMATE_WINDOW;
+        if (sample.same_shape && !before.empty() && sample.lo == last.lo && sample.hi == last.hi) {
+            for (int cell = sample.lo; cell <= sample.hi; cell++) {
+                sample.deltas.push_back((signed char)(paged_cell(machine.tape, cell) - before[cell - sample.lo]));
+            }
+            sample.measured = true;
+            repeats = last.measured && sample.deltas == last.deltas ? repeats + 1 : 0;
+        } else {
+            repeats = 0;
+        }
+
+        if (sample.measured && std::all_of(sample.deltas.begin(), sample.deltas.end(), [](signed char delta) { return delta == 0; })) {
+            // the iteration left every cell it touched as it found them, so the loop runs forever
+            estimate.diverges = true;
+            break;
+        }
+        if (repeats >= BRAINFUCK_ESTIMATE_LOOP_SAMPLES) {
+            int step = sample.deltas[entry - sample.lo];
+            unsigned char counter = paged_cell(machine.tape, entry);
+            uint32_t iterations = 1;
+            while (iterations < 256 && (unsigned char)(counter + iterations * step) != 0) {
+                iterations++;
+            }
+            // half the budget left is kept back for the loops around this one to be sampled too,
+            // and once half of the budget is gone every loop that can be is extrapolated
+            uint64_t left = BRAINFUCK_ESTIMATE_SAMPLE_BUDGET - std::min<uint64_t>(estimate.sampled_ops, BRAINFUCK_ESTIMATE_SAMPLE_BUDGET);
+            if (iterations < 256 && (iterations * sample.sampled_ops > left / 2 || left < BRAINFUCK_ESTIMATE_SAMPLE_BUDGET / 2)) {
+                for (int cell = sample.lo; cell <= sample.hi; cell++) {
+                    paged_cell(machine.tape, cell) += char(sample.deltas[cell - sample.lo] * int(iterations));
+                }
+                double n = iterations;
+                double slope = double(sample.ops) - double(last.ops);
+                add_ops(estimate, std::max(n * sample.ops + slope * n * (n + 1) / 2, n));
+                estimate.extrapolated_loops++;
+                estimate.exact = false;
+                break;
+            }
+        }
+        last = std::move(sample);
+    }
+    estimate.ops++;
+    estimate.sampled_ops++;
+    machine.lo = std::min(outer_lo, lo);
+    machine.hi = std::max(outer_hi, hi);
+    touch(machine, machine.ptr);
+}
+
+/**
+ estimate a block by running it on the scratch machine, recognised loops are done in closed form
+
+ @param block   compiled block
+ @param machine scratch machine
+ @param estimate the estimate to add to
+*/
+static void estimate_block(const brainfuck_block & block, cost_machine & machine, cost_estimate & estimate) {
+    for (const auto & op : block.ops) {
+        if (estimate.truncated || estimate.diverges) {
+            return;
+        }
+        if (estimate.sampled_ops >= BRAINFUCK_ESTIMATE_SAMPLE_BUDGET) {
+            estimate.truncated = true;
+            estimate.exact = false;
+            return;
+        }
+        std::visit(brainfuck_vm {
+            [&](const add_ir & add) {
+                paged_cell(machine.tape, machine.ptr) += char(add.delta);
+                estimate.ops++;
+                estimate.sampled_ops++;
+            },
+            [&](const move_ir & move) {
+                machine.ptr += move.delta;
+                touch(machine, machine.ptr);
+                estimate.ops++;
+                estimate.sampled_ops++;
+            },
+            [&](const print_ir &) {
+                estimate.ops++;
+                estimate.sampled_ops++;
+            },
+            [&](const read_ir &) {
+                paged_cell(machine.tape, machine.ptr) = 0;
+                estimate.reads_input = true;
+                estimate.ops++;
+                estimate.sampled_ops++;
+            },
+            [&](const loop_ir & loop) {
+                if (paged_cell(machine.tape, machine.ptr) == 0) {
+                    estimate.ops++;
+                    estimate.sampled_ops++;
+                    return;
+                }
+                if (estimate_closed_form(*loop.body, machine, estimate)) {
+                    return;
+                }
+                sample_loop(*loop.body, machine, estimate);
+            }
+        }, op);
+    }
+}
+
+cost_estimate estimate_cost(const brainfuck_block & program) {
+    cost_estimate estimate;
+    cost_machine machine;
+    estimate_block(program, machine, estimate);
+    return estimate;
+}
+
+uint64_t calibrate_ops_per_second(clock_control & clock) {
+    static std::map<uint32_t, uint64_t> calibrated;
+    uint32_t khz = clock.get_khz();
+    if (auto rate = calibrated.find(khz); rate != calibrated.end()) {
+        return rate->second;
+    }
+
+    // compiled once for every clock
+    static std::shared_ptr<const brainfuck_program> kernel = compile_program(clock_benchmark_kernel, strlen(clock_benchmark_kernel));
+    brainfuck_vm_status status;
+    load_program(status, kernel);
+    uint64_t start = clock.now_us();
+    run_compiled(status);
+    uint64_t elapsed = std::max<uint64_t>(clock.now_us() - start, 1);
+
+    uint64_t rate = std::max<uint64_t>(status.instruction_executed * 1000000 / elapsed, 1);
+    calibrated[khz] = rate;
+    return rate;
+}
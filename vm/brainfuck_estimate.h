@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include "brainfuck_clock.h"
+#include "brainfuck_ir.h"
+
+/// compiled ops the estimator may step through before giving up on exactness
+#define BRAINFUCK_ESTIMATE_SAMPLE_BUDGET 2000000
+/// iterations in a row that must change the tape the same way before a loop is extrapolated
+#define BRAINFUCK_ESTIMATE_LOOP_SAMPLES 4
+/// widest span of cells an iteration may touch and still be extrapolated
+#define BRAINFUCK_ESTIMATE_WINDOW 4096
+
+#pragma mark - cost estimation
+
+/// predicted cost of running a compiled program
+struct cost_estimate {
+    /// compiled ops, counting one per loop test, saturating
+    uint64_t ops = 0;
+    /// `ops` is the exact count, false if a loop was extrapolated or the sample budget ran out
+    bool exact = true;
+    /// the sample budget ran out before the program ended, `ops` is then a lower bound
+    bool truncated = false;
+    /// loop runs whose remaining iterations were projected from sampled ones, `ops` is then
+    /// an approximation unless truncated
+    uint32_t extrapolated_loops = 0;
+    /// a loop provably never ends
+    bool diverges = false;
+    /// the program reads input, every `,` was assumed to read 0
+    bool reads_input = false;
+    /// loops evaluated in closed form
+    uint32_t closed_form_loops = 0;
+    /// compiled ops actually stepped through
+    uint64_t sampled_ops = 0;
+};
+
+/**
+ predict how many compiled ops a program executes
+
+ @param program compiled program
+ @return cost_estimate
+*/
+cost_estimate estimate_cost(const brainfuck_block & program);
+
+/**
+ compiled ops per second the vm manages at the current clock,
+ measured once per clock by timing the benchmark kernel
+
+ @param clock the system clock
+ @return ops per second
+*/
+uint64_t calibrate_ops_per_second(clock_control & clock);
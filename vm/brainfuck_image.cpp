@@ -0,0 +1,372 @@
+#include "brainfuck_image.h"
+#include <algorithm>
+#include <cstring>
+#include "brainfuck_diag.h"
+
+/// header fields, in words
+enum image_header_word {
+    header_magic,
+    header_code_words,
+    header_flags,
+    header_extent_min,
+    header_extent_max
+};
+
+/**
+ opcode of an image word
+
+ @param word image word
+ @return image_op
+*/
+static inline image_op opcode(uint32_t word) {
+    return image_op(word & 0xff);
+}
+
+/**
+ operand of an image word
+
+ @param word image word
+ @return the signed operand
+*/
+static inline int32_t operand(uint32_t word) {
+    return int32_t(word) >> 8;
+}
+
+#pragma mark - building images
+
+/// appends the words of a program to an image
+struct image_builder {
+    /**
+     append an op
+
+     @param op    opcode
+     @param value operand, the image is marked as not fitting if it is out of range
+    */
+    void emit(image_op op, int64_t value) {
+        if (value < BRAINFUCK_IMAGE_OPERAND_MIN || value > BRAINFUCK_IMAGE_OPERAND_MAX) {
+            fits = false;
+        }
+        words.push_back(uint32_t(value) << 8 | uint32_t(op));
+    }
+
+    /**
+     append a whole word after an op
+
+     @param value the word
+    */
+    void emit_word(int64_t value) {
+        if (value < 0 || value > INT32_MAX) {
+            fits = false;
+        }
+        words.push_back(uint32_t(value));
+    }
+
+    /**
+     append a block and, in place, the bodies of its loops
+
+     @param block compiled block
+     @param base  instruction index the pcs in block are relative to
+    */
+    void emit_block(const brainfuck_block & block, int64_t base) {
+        emit(image_op::block, block.run_cost[0]);
+        for (size_t index = 0; index < block.ops.size(); index++) {
+            std::visit(brainfuck_vm {
+                [&](const add_ir & add) { emit(image_op::add, add.delta); },
+                [&](const move_ir & move) { emit(image_op::move, move.delta); },
+                [&](const print_ir & print) { emit(image_op::print, base + print.pc); },
+                [&](const read_ir & read) {
+                    emit(image_op::read, base + read.pc);
+                    emit_word(block.run_cost[index]);
+                },
+                [&](const loop_ir & loop) {
+                    size_t open = words.size();
+                    emit(image_op::open, 0);
+                    emit_block(*loop.body, base + loop.start);
+                    emit(image_op::close, int64_t(open + 1) - int64_t(words.size()));
+                    emit_word(base + loop.start + loop.end);
+                    // the body is in, the jump past it is known now
+                    words[open] = uint32_t(words.size() - open) << 8 | uint32_t(image_op::open);
+                    emit(image_op::block, block.run_cost[index + 1]);
+                }
+            }, block.ops[index]);
+        }
+    }
+
+    std::vector<uint32_t> words;
+    /// every operand was in range
+    bool fits = true;
+};
+
+std::vector<uint32_t> build_image(const brainfuck_program & program) {
+    image_builder builder;
+    builder.words.resize(BRAINFUCK_IMAGE_HEADER_WORDS);
+    builder.emit_block(program.code, 0);
+    builder.emit(image_op::end, 0);
+    if (!builder.fits || builder.words.size() - BRAINFUCK_IMAGE_HEADER_WORDS > BRAINFUCK_IMAGE_OPERAND_MAX) {
+        return {};
+    }
+
+    std::vector<uint32_t> & image = builder.words;
+    memcpy(&image[header_magic], BRAINFUCK_IMAGE_MAGIC, 3);
+    image[header_magic] |= uint32_t(BRAINFUCK_IMAGE_VERSION) << 24;
+    image[header_code_words] = uint32_t(image.size() - BRAINFUCK_IMAGE_HEADER_WORDS);
+    // an extent too long for a bounded tape is run on the user's tape, as if it drifted
+    bool bounded = program.extent.bounded && int64_t(program.extent.max) - program.extent.min + 1 <= BRAINFUCK_VM_TAPE_LEN;
+    image[header_flags] = bounded ? BRAINFUCK_IMAGE_BOUNDED : 0;
+    image[header_extent_min] = uint32_t(program.extent.min);
+    image[header_extent_max] = uint32_t(program.extent.max);
+    return std::move(image);
+}
+
+#pragma mark - verifying images
+
+/// an `open` whose `close` is still to come
+struct image_open {
+    /// word of the `open`
+    uint32_t at;
+    /// pointer shift when the loop was entered
+    int64_t shift;
+};
+
+const char * verify_image(const void * image, size_t len) {
+    if (reinterpret_cast<uintptr_t>(image) % alignof(uint32_t) != 0) {
+        return "image is not 4-byte aligned";
+    }
+    if (len < BRAINFUCK_IMAGE_HEADER_WORDS * sizeof(uint32_t) || len % sizeof(uint32_t) != 0) {
+        return "image is truncated";
+    }
+    const uint32_t * header = static_cast<const uint32_t *>(image);
+    if (memcmp(header, BRAINFUCK_IMAGE_MAGIC, 3) != 0) {
+        return "not an image";
+    }
+    if (header[header_magic] >> 24 != BRAINFUCK_IMAGE_VERSION) {
+        return "unsupported image version";
+    }
+    size_t words = len / sizeof(uint32_t) - BRAINFUCK_IMAGE_HEADER_WORDS;
+    if (header[header_code_words] != words || words == 0) {
+        return "image length does not match its header";
+    }
+    if (header[header_flags] & ~BRAINFUCK_IMAGE_BOUNDED) {
+        return "unknown image flags";
+    }
+    if (header[header_flags] & BRAINFUCK_IMAGE_BOUNDED) {
+        // the extent sizes the tape, it must be one that size_tape_for can allocate
+        int64_t extent_min = int32_t(header[header_extent_min]);
+        int64_t extent_max = int32_t(header[header_extent_max]);
+        if (extent_max < extent_min || extent_max - extent_min + 1 > BRAINFUCK_VM_TAPE_LEN) {
+            return "extent in the header does not fit a bounded tape";
+        }
+    }
+
+    const uint32_t * code = header + BRAINFUCK_IMAGE_HEADER_WORDS;
+    std::vector<image_open> opens;
+    // the block being checked: where its `block` word is, ops counted so far,
+    // and the `,` in it as their word and the ops before them
+    size_t block_at = 0;
+    uint32_t cost = 0;
+    std::vector<std::pair<size_t, uint32_t>> reads;
+    bool block_expected = true;
+    bool bounded = true;
+    int64_t shift = 0;
+    int64_t min = 0;
+    int64_t max = 0;
+
+    // the block ends with `cost` ops, it and every `,` in it must have been charged that much
+    auto end_block = [&]() {
+        if (uint32_t(operand(code[block_at])) != cost) {
+            return false;
+        }
+        for (const auto & read : reads) {
+            if (code[read.first + 1] != cost - read.second) {
+                return false;
+            }
+        }
+        reads.clear();
+        block_expected = true;
+        return true;
+    };
+
+    for (size_t i = 0; i < words; i++) {
+        uint32_t word = code[i];
+        if (block_expected != (opcode(word) == image_op::block)) {
+            return "basic block without its cost";
+        }
+        switch (opcode(word)) {
+            case image_op::block:
+                if (operand(word) < 0) {
+                    return "negative block cost";
+                }
+                block_at = i;
+                cost = 0;
+                block_expected = false;
+                break;
+            case image_op::add:
+                cost++;
+                break;
+            case image_op::move:
+                cost++;
+                shift += operand(word);
+                min = std::min(min, shift);
+                max = std::max(max, shift);
+                break;
+            case image_op::print:
+                cost++;
+                break;
+            case image_op::read:
+                if (i + 1 >= words) {
+                    return "image is truncated";
+                }
+                reads.emplace_back(i, cost);
+                cost++;
+                i++;
+                break;
+            case image_op::open:
+                cost++;
+                if (!end_block()) {
+                    return "block cost does not match its ops";
+                }
+                opens.push_back({uint32_t(i), shift});
+                break;
+            case image_op::close: {
+                if (i + 1 >= words) {
+                    return "image is truncated";
+                }
+                if (opens.empty()) {
+                    return "unmatched close";
+                }
+                image_open open = opens.back();
+                opens.pop_back();
+                if (int64_t(i) + operand(word) != int64_t(open.at) + 1 ||
+                    int64_t(open.at) + operand(code[open.at]) != int64_t(i) + 2) {
+                    return "open and close do not jump to each other";
+                }
+                cost++;
+                if (!end_block()) {
+                    return "block cost does not match its ops";
+                }
+                if (shift != open.shift) {
+                    // the loop drifts, it may run any number of times
+                    bounded = false;
+                }
+                i++;
+                break;
+            }
+            case image_op::end:
+                if (i + 1 != words || !opens.empty()) {
+                    return "image ends inside a loop";
+                }
+                if (!end_block()) {
+                    return "block cost does not match its ops";
+                }
+                if ((header[header_flags] & BRAINFUCK_IMAGE_BOUNDED) &&
+                    (!bounded || min < int32_t(header[header_extent_min]) || max > int32_t(header[header_extent_max]))) {
+                    // a bounded tape is sized from the header and never checked while running
+                    return "pointer leaves the extent in the header";
+                }
+                return nullptr;
+            default:
+                return "unknown opcode";
+        }
+    }
+    return "image does not end";
+}
+
+tape_extent image_extent(const void * image) {
+    const uint32_t * header = static_cast<const uint32_t *>(image);
+    tape_extent extent;
+    extent.bounded = header[header_flags] & BRAINFUCK_IMAGE_BOUNDED;
+    extent.min = int32_t(header[header_extent_min]);
+    extent.max = int32_t(header[header_extent_max]);
+    return extent;
+}
+
+#pragma mark - running images
+
+void load_image(brainfuck_vm_status & status, const void * image) {
+    status.program.reset();
+    status.frames.clear();
+    status.image = static_cast<const uint32_t *>(image) + BRAINFUCK_IMAGE_HEADER_WORDS;
+    status.image_pc = 0;
+    bind_ring_tape(status);
+}
+
+run_result run_image(brainfuck_vm_status & status) {
+    const uint32_t * code = status.image;
+    if (!code) {
+        return run_result::finished;
+    }
+    uint32_t pc = status.image_pc;
+    bind_ring_tape(status);
+
+    // a run suspended on `,` starts again at it, paying for the rest of its block again
+    if (opcode(code[pc]) == image_op::read) {
+        if (code[pc + 1] > status.fuel) {
+            return run_result::out_of_fuel;
+        }
+        status.fuel -= code[pc + 1];
+        status.instruction_executed += code[pc + 1];
+    }
+
+    while (true) {
+        uint32_t word = code[pc];
+        switch (opcode(word)) {
+            case image_op::block: {
+                uint32_t cost = uint32_t(operand(word));
+                if (cost > status.fuel) {
+                    status.image_pc = pc;
+                    return run_result::out_of_fuel;
+                }
+                status.fuel -= cost;
+                status.instruction_executed += cost;
+                pc++;
+                break;
+            }
+            case image_op::add:
+                tape_cell(status) += char(operand(word));
+                BRAINFUCK_PROFILE(status, 1, 1);
+                pc++;
+                break;
+            case image_op::move:
+                status.tape_ptr = (status.tape_ptr + operand(word)) & status.tape_ptr_mask;
+                pc++;
+                break;
+            case image_op::print:
+                status.io->put(tape_cell(status));
+                BRAINFUCK_TRACE(status, operand(word), '.');
+                BRAINFUCK_PROFILE(status, 1, 0);
+                pc++;
+                break;
+            case image_op::read:
+                if (!status.io->ready()) {
+                    // give back what the rest of the block was charged, it restarts at this `,`
+                    status.fuel += code[pc + 1];
+                    status.instruction_executed -= code[pc + 1];
+                    status.image_pc = pc;
+                    return run_result::waiting_for_input;
+                }
+                tape_cell(status) = status.io->get();
+                BRAINFUCK_TRACE(status, operand(word), ',');
+                BRAINFUCK_PROFILE(status, 0, 1);
+                pc += 2;
+                break;
+            case image_op::open:
+                BRAINFUCK_PROFILE(status, 1, 0);
+                pc = tape_cell(status) != 0 ? pc + 1 : pc + operand(word);
+                break;
+            case image_op::close:
+                BRAINFUCK_PROFILE(status, 1, 0);
+                if (tape_cell(status) != 0) {
+                    BRAINFUCK_TRACE(status, int(code[pc + 1]), ']');
+                    pc += operand(word);
+                } else {
+                    pc += 2;
+                }
+                break;
+            default:
+                // end, and nothing else gets past verify_image
+                status.image = nullptr;
+                status.image_pc = 0;
+                return run_result::finished;
+        }
+    }
+}
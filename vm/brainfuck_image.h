@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "brainfuck_ir.h"
+
+/// images start with "BFI" and the format version
+#define BRAINFUCK_IMAGE_MAGIC "BFI"
+#define BRAINFUCK_IMAGE_VERSION 1
+/// header words: magic and version, code words, flags, lowest and highest cell reached
+#define BRAINFUCK_IMAGE_HEADER_WORDS 5
+/// header flag, the program never moves the pointer outside the cells in the header
+#define BRAINFUCK_IMAGE_BOUNDED 1u
+/// range of the signed 24-bit operand of an image word
+#define BRAINFUCK_IMAGE_OPERAND_MIN (-(1 << 23))
+#define BRAINFUCK_IMAGE_OPERAND_MAX ((1 << 23) - 1)
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "images are little endian words run in place");
+
+#pragma mark - bytecode images
+
+// an image is a compiled program flattened into 32-bit little endian words, built on the host
+// where compiling is cheap and run in place from flash or RAM by the device, which then
+// never compiles it
+//
+//   header  'B' 'F' 'I' version | code words | flags | extent min | extent max
+//   code    operand << 8 | opcode, one or two words per op
+//
+// jumps are relative to the word they are in, so an image runs from wherever it is stored;
+// pcs are instruction indices in the source, only used by the trace
+//
+// every basic block starts with a `block` word carrying its cost, so fuel is paid exactly as
+// run_compiled pays it and both engines count the same ops
+
+/// opcode in the low byte of an image word
+enum class image_op : uint8_t {
+    /// the program ends
+    end,
+    /// a basic block starts, operand is its run_cost
+    block,
+    /// operand is the delta added to the current cell
+    add,
+    /// operand is the delta added to the tape pointer
+    move,
+    /// operand is the pc of the `.`
+    print,
+    /// operand is the pc of the `,`, the next word is the cost of the rest of its block
+    read,
+    /// jump by operand words, past the matching `close`, if the current cell is 0
+    open,
+    /// jump by operand words, back to the loop body, unless the current cell is 0,
+    /// the next word is the pc of the `]`
+    close
+};
+
+/**
+ flatten a compiled program into an image, loops sharing a body get a copy each
+
+ @param program compiled program
+ @return the image, header included, or an empty vector if an operand does not fit in 24 bits
+*/
+std::vector<uint32_t> build_image(const brainfuck_program & program);
+
+/**
+ check an image in a single pass before it is run: the header, every opcode, that brackets pair
+ up and jump to each other, that every block and `,` is charged what it costs, and that a
+ bounded extent in the header is really where the pointer stays, so a bounded tape is safe
+
+ @param image the image, 4-byte aligned
+ @param len   length of the image in bytes
+ @return nullptr if the image can be run, what is wrong with it otherwise
+*/
+const char * verify_image(const void * image, size_t len);
+
+/**
+ cells a verified image reaches, from its header
+
+ @param image verified image
+ @return tape_extent, its shift is not recorded
+*/
+tape_extent image_extent(const void * image);
+
+/**
+ load a verified image into the vm, the tape is left as it is and the image is not copied,
+ it has to stay where it is until the run ends
+
+ @param status the brainfuck vm status
+ @param image  verified image
+*/
+void load_image(brainfuck_vm_status & status, const void * image);
+
+/**
+ run the loaded image until it ends, runs out of fuel or waits for input, with the same
+ fuel, op count and resumption as run_compiled
+
+ @param status the brainfuck vm status
+ @return run_result
+*/
+run_result run_image(brainfuck_vm_status & status);
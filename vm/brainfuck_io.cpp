@@ -0,0 +1,6 @@
+#include "brainfuck_io.h"
+
+brainfuck_io & default_io() {
+    static stdio_io io;
+    return io;
+}
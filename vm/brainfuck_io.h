@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+/// FNV-1a 64-bit offset basis, the digest of no output
+#define BRAINFUCK_DIGEST_OFFSET 0xcbf29ce484222325ull
+/// FNV-1a 64-bit prime
+#define BRAINFUCK_DIGEST_PRIME 0x100000001b3ull
+
+#pragma mark - brainfuck io
+
+/// where `.` writes to and `,` reads from
+struct brainfuck_io {
+    virtual ~brainfuck_io() = default;
+
+    /// write one byte of program output
+    virtual void put(char c) = 0;
+    /// read one byte of program input, EOF if there is none
+    virtual int get() = 0;
+    /// whether get() would return right away, run_compiled suspends on `,` otherwise
+    virtual bool ready() {
+        return true;
+    }
+};
+
+/// brainfuck_io over the C stdio, USB serial on the Pico and the terminal on a host
+struct stdio_io : brainfuck_io {
+    void put(char c) override {
+        putchar(c);
+    }
+
+    int get() override {
+        return getchar();
+    }
+};
+
+/// brainfuck_io hashing output instead of transporting it, for benchmarks without I/O cost
+/// and cheap comparisons against known outputs
+struct digest_io : brainfuck_io {
+    /**
+     @param input where `,` reads from, nullptr reads 0
+    */
+    explicit digest_io(brainfuck_io * input = nullptr) : input(input) {}
+
+    void put(char c) override {
+        digest = (digest ^ static_cast<unsigned char>(c)) * BRAINFUCK_DIGEST_PRIME;
+        written++;
+    }
+
+    int get() override {
+        return input ? input->get() : 0;
+    }
+
+    bool ready() override {
+        return input ? input->ready() : true;
+    }
+
+    /// forget the output seen so far
+    void clear() {
+        digest = BRAINFUCK_DIGEST_OFFSET;
+        written = 0;
+    }
+
+    brainfuck_io * input;
+    /// FNV-1a of every byte written
+    uint64_t digest = BRAINFUCK_DIGEST_OFFSET;
+    /// number of bytes written
+    uint64_t written = 0;
+};
+
+/**
+ the shared stdio_io, the default io of every vm
+
+ @return stdio_io
+*/
+brainfuck_io & default_io();
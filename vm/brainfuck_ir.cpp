@@ -0,0 +1,322 @@
+#include "brainfuck_ir.h"
+#include <algorithm>
+#include <type_traits>
+#include "brainfuck_diag.h"
+
+#pragma mark - brainfuck compiler
+
+void finish_block(brainfuck_block & block, bool loop_body) {
+    block.run_cost.resize(block.ops.size() + 1);
+    block.run_cost.back() = loop_body ? 1 : 0;
+    for (size_t i = block.ops.size(); i-- > 0;) {
+        if (std::holds_alternative<loop_ir>(block.ops[i])) {
+            block.run_cost[i] = 1;
+        } else {
+            block.run_cost[i] = block.run_cost[i + 1] + 1;
+        }
+    }
+}
+
+/**
+ append a folded add or move to a block, merging it into the previous op if possible
+
+ @param block the block
+ @param delta amount to add or move by
+*/
+template <typename IR>
+void fold_ir(brainfuck_block & block, int delta) {
+    if (!block.ops.empty()) {
+        if (auto last = std::get_if<IR>(&block.ops.back())) {
+            last->delta += delta;
+            if (last->delta == 0 || (std::is_same_v<IR, add_ir> && last->delta % 256 == 0)) {
+                block.ops.pop_back();
+            }
+            return;
+        }
+    }
+    block.ops.emplace_back(IR{delta});
+}
+
+void bf_compiler::feed(char c) {
+    auto op = bf_op_map.find(c);
+    if (op == bf_op_map.end() || !balanced) {
+        return;
+    }
+    pc++;
+    std::visit(brainfuck_vm {
+        [&](increment_value_op) { fold_ir<add_ir>(blocks.back(), 1); },
+        [&](decrement_value_op) { fold_ir<add_ir>(blocks.back(), -1); },
+        [&](increment_ptr_op) { fold_ir<move_ir>(blocks.back(), 1); },
+        [&](decrement_ptr_op) { fold_ir<move_ir>(blocks.back(), -1); },
+        [&](print_op) { blocks.back().ops.emplace_back(print_ir{pc - starts.back()}); },
+        [&](read_op) { blocks.back().ops.emplace_back(read_ir{pc - starts.back()}); },
+        [&](loop_start_op) {
+            blocks.emplace_back();
+            starts.push_back(pc);
+        },
+        [&](loop_end_op) {
+            if (blocks.size() == 1) {
+                balanced = false;
+                return;
+            }
+            finish_block(blocks.back(), true);
+            int start = starts.back();
+            starts.pop_back();
+
+            // share the body with an identical loop compiled earlier
+            size_t hash = hash_block(blocks.back());
+            std::shared_ptr<const brainfuck_block> body;
+            for (auto [it, last] = bodies.equal_range(hash); it != last; ++it) {
+                if (same_block(*it->second, blocks.back())) {
+                    body = it->second;
+                    break;
+                }
+            }
+            if (!body) {
+                body = std::make_shared<const brainfuck_block>(std::move(blocks.back()));
+                bodies.emplace(hash, body);
+            }
+            blocks.pop_back();
+            blocks.back().ops.emplace_back(loop_ir{std::move(body), start - starts.back(), pc - start});
+        },
+        [&](std::monostate) {}
+    }, op->second);
+}
+
+size_t hash_block(const brainfuck_block & block) {
+    // FNV-1a over the kind and the fields of every op
+    size_t hash = size_t(BRAINFUCK_DIGEST_OFFSET);
+    auto mix = [&](size_t value) {
+        hash = (hash ^ value) * size_t(BRAINFUCK_DIGEST_PRIME);
+    };
+    for (const auto & op : block.ops) {
+        mix(op.index());
+        std::visit(brainfuck_vm {
+            [&](const add_ir & add) { mix(size_t(add.delta)); },
+            [&](const move_ir & move) { mix(size_t(move.delta)); },
+            [&](const print_ir & print) { mix(size_t(print.pc)); },
+            [&](const read_ir & read) { mix(size_t(read.pc)); },
+            [&](const loop_ir & loop) {
+                mix(reinterpret_cast<uintptr_t>(loop.body.get()));
+                mix(size_t(loop.start));
+                mix(size_t(loop.end));
+            }
+        }, op);
+    }
+    return hash;
+}
+
+bool same_block(const brainfuck_block & a, const brainfuck_block & b) {
+    if (a.ops.size() != b.ops.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.ops.size(); i++) {
+        const brainfuck_ir & other = b.ops[i];
+        if (a.ops[i].index() != other.index()) {
+            return false;
+        }
+        bool same = std::visit(brainfuck_vm {
+            [&](const add_ir & add) { return add.delta == std::get<add_ir>(other).delta; },
+            [&](const move_ir & move) { return move.delta == std::get<move_ir>(other).delta; },
+            [&](const print_ir & print) { return print.pc == std::get<print_ir>(other).pc; },
+            [&](const read_ir & read) { return read.pc == std::get<read_ir>(other).pc; },
+            [&](const loop_ir & loop) {
+                const loop_ir & other_loop = std::get<loop_ir>(other);
+                return loop.body == other_loop.body && loop.start == other_loop.start && loop.end == other_loop.end;
+            }
+        }, a.ops[i]);
+        if (!same) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<brainfuck_block> bf_compiler::finish() {
+    if (!balanced || blocks.size() != 1) {
+        return std::nullopt;
+    }
+    finish_block(blocks.front(), false);
+    return std::move(blocks.front());
+}
+
+std::optional<brainfuck_block> compile_bf(const char * source, size_t len) {
+    bf_compiler compiler;
+    for (size_t i = 0; i < len; i++) {
+        compiler.feed(source[i]);
+    }
+    return compiler.finish();
+}
+
+#pragma mark - tape extent analysis
+
+tape_extent analyse_extent(const brainfuck_block & block) {
+    tape_extent extent;
+    for (const auto & op : block.ops) {
+        std::visit(brainfuck_vm {
+            [&](const move_ir & move) {
+                extent.shift += move.delta;
+                extent.min = std::min(extent.min, extent.shift);
+                extent.max = std::max(extent.max, extent.shift);
+            },
+            [&](const loop_ir & loop) {
+                tape_extent body = analyse_extent(*loop.body);
+                if (!body.bounded || body.shift != 0) {
+                    // a loop with a non-zero stride runs for an unknown number of iterations
+                    extent.bounded = false;
+                    return;
+                }
+                extent.min = std::min(extent.min, extent.shift + body.min);
+                extent.max = std::max(extent.max, extent.shift + body.max);
+            },
+            [&](const auto &) {}
+        }, op);
+        if (!extent.bounded) {
+            break;
+        }
+    }
+    return extent;
+}
+
+bool size_tape_for(brainfuck_vm_status & status, const tape_extent & extent) {
+    // in 64 bits, an image header may declare any extent
+    if (!extent.bounded || extent.max < extent.min || int64_t(extent.max) - extent.min + 1 > BRAINFUCK_VM_TAPE_LEN) {
+        return false;
+    }
+    use_bounded_tape(status, extent.min, extent.max);
+    return true;
+}
+
+bool size_tape_for(brainfuck_vm_status & status, const brainfuck_block & program) {
+    return size_tape_for(status, analyse_extent(program));
+}
+
+#pragma mark - compiled programs
+
+std::shared_ptr<const brainfuck_program> compile_program(const char * source, size_t len) {
+    std::optional<brainfuck_block> code = compile_bf(source, len);
+    if (!code) {
+        return nullptr;
+    }
+    return make_program(std::move(*code));
+}
+
+std::shared_ptr<const brainfuck_program> make_program(brainfuck_block code) {
+    auto program = std::make_shared<brainfuck_program>();
+    program->code = std::move(code);
+    program->extent = analyse_extent(program->code);
+    return program;
+}
+
+bool size_tape_for(brainfuck_vm_status & status, const brainfuck_program & program) {
+    return size_tape_for(status, program.extent);
+}
+
+#pragma mark - compiled engine
+
+void load_program(brainfuck_vm_status & status, std::shared_ptr<const brainfuck_block> program) {
+    status.program = std::move(program);
+    status.frames.clear();
+    status.frames.push_back({status.program.get(), 0});
+    bind_ring_tape(status);
+}
+
+void load_program(brainfuck_vm_status & status, const std::shared_ptr<const brainfuck_program> & program) {
+    // the vm holds the program through its code
+    load_program(status, std::shared_ptr<const brainfuck_block>(program, &program->code));
+}
+
+const loop_ir & innermost_loop(const brainfuck_vm_status & status) {
+    const ir_frame & parent = status.frames[status.frames.size() - 2];
+    return std::get<loop_ir>(parent.block->ops[parent.index - 1]);
+}
+
+int frame_pc(const brainfuck_vm_status & status) {
+    int pc = 0;
+    for (size_t i = 1; i < status.frames.size(); i++) {
+        const ir_frame & parent = status.frames[i - 1];
+        pc += std::get<loop_ir>(parent.block->ops[parent.index - 1]).start;
+    }
+    return pc;
+}
+
+run_result run_compiled(brainfuck_vm_status & status) {
+    // once per run, a resumed run may be on the other core or follow another vm's run
+    bind_ring_tape(status);
+    while (!status.frames.empty()) {
+        ir_frame & frame = status.frames.back();
+        const brainfuck_block & block = *frame.block;
+
+        uint32_t cost = block.run_cost[frame.index];
+        if (cost > status.fuel) {
+            return run_result::out_of_fuel;
+        }
+        status.fuel -= cost;
+        status.instruction_executed += cost;
+
+        bool at_loop = false;
+        bool suspended = false;
+        for (size_t index = frame.index; index < block.ops.size() && !at_loop && !suspended; index++) {
+            std::visit(brainfuck_vm {
+                [&](const add_ir & add) {
+                    tape_cell(status) += char(add.delta);
+                    BRAINFUCK_PROFILE(status, 1, 1);
+                },
+                [&](const move_ir & move) {
+                    status.tape_ptr = (status.tape_ptr + move.delta) & status.tape_ptr_mask;
+                },
+                [&](const print_ir & print) {
+                    (void)print;
+                    status.io->put(tape_cell(status));
+                    BRAINFUCK_TRACE(status, frame_pc(status) + print.pc, '.');
+                    BRAINFUCK_PROFILE(status, 1, 0);
+                },
+                [&](const read_ir & read) {
+                    (void)read;
+                    if (!status.io->ready()) {
+                        // give back what the rest of the block was charged, it restarts at this `,`
+                        status.fuel += block.run_cost[index];
+                        status.instruction_executed -= block.run_cost[index];
+                        frame.index = index;
+                        suspended = true;
+                        return;
+                    }
+                    tape_cell(status) = status.io->get();
+                    BRAINFUCK_TRACE(status, frame_pc(status) + read.pc, ',');
+                    BRAINFUCK_PROFILE(status, 0, 1);
+                },
+                [&](const loop_ir & loop) {
+                    // the loop test ends the basic block, the next one starts after the loop
+                    BRAINFUCK_PROFILE(status, 1, 0);
+                    frame.index = index + 1;
+                    at_loop = true;
+                    if (tape_cell(status) != 0) {
+                        status.frames.push_back({loop.body.get(), 0});
+                    }
+                }
+            }, block.ops[index]);
+        }
+        if (suspended) {
+            return run_result::waiting_for_input;
+        }
+        if (at_loop) {
+            continue;
+        }
+
+        if (status.frames.size() == 1) {
+            // end of the program
+            status.frames.pop_back();
+            break;
+        }
+
+        // end of a loop body, its back-edge test was paid for with the block
+        BRAINFUCK_PROFILE(status, 1, 0);
+        if (tape_cell(status) != 0) {
+            BRAINFUCK_TRACE(status, frame_pc(status) + innermost_loop(status).end, ']');
+            frame.index = 0;
+        } else {
+            status.frames.pop_back();
+        }
+    }
+    return run_result::finished;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "brainfuck_vm.h"
+
+#pragma mark - brainfuck compiler
+
+struct brainfuck_block;
+
+// instruction indices (pc) in the IR are relative to the `[` of the loop they are in,
+// or to the start of the program, so identical loops compile to identical bodies
+
+/// add `delta` to the current cell, folded from a run of + and -
+struct add_ir { int delta; };
+/// move the tape pointer by `delta`, folded from a run of > and <
+struct move_ir { int delta; };
+/// ., `pc` is its instruction index
+struct print_ir { int pc; };
+/// ,
+struct read_ir { int pc; };
+/// [ body ], `start` is the instruction index of the `[`, `end` that of the `]` relative to the `[`
+/// the body may be shared with every other loop that compiled to the same ops
+struct loop_ir { std::shared_ptr<const brainfuck_block> body; int start; int end; };
+
+/// compiled form of brainfuck_op
+using brainfuck_ir = std::variant<
+    add_ir,
+    move_ir,
+    print_ir,
+    read_ir,
+    loop_ir
+>;
+
+/// straight sequence of compiled ops, a whole program or the body of a loop
+struct brainfuck_block {
+    std::vector<brainfuck_ir> ops;
+    /// `run_cost[i]` is the number of ops executed from op `i` up to and including
+    /// the next loop test, the basic block starting at `i`
+    /// the last entry is the cost of reaching the end, 1 for the back-edge test of a loop body
+    std::vector<uint32_t> run_cost;
+};
+
+/**
+ fill in the run_cost of a finished block
+
+ @param block     the block
+ @param loop_body whether the block is a loop body, ending in a back-edge test
+*/
+void finish_block(brainfuck_block & block, bool loop_body);
+
+/// compiles brainfuck source fed one character at a time, so it can come from a stream
+struct bf_compiler {
+    /**
+     compile the next character of the source, comments are skipped
+
+     @param c source character
+    */
+    void feed(char c);
+
+    /**
+     finish compiling, the compiler must not be fed afterwards
+
+     @return the program, or std::nullopt if the brackets are not balanced
+    */
+    std::optional<brainfuck_block> finish();
+
+    /// the innermost open loop is at the back
+    std::vector<brainfuck_block> blocks = std::vector<brainfuck_block>(1);
+    /// instruction index of the `[` of each open loop, 0 for the program
+    std::vector<int> starts = std::vector<int>(1, 0);
+    /// finished loop bodies by hash_block, a body compiled again is replaced by the one found here
+    std::unordered_multimap<size_t, std::shared_ptr<const brainfuck_block>> bodies;
+    /// a `]` had no matching `[`
+    bool balanced = true;
+    /// instruction index, comments are not counted
+    int pc = -1;
+};
+
+/**
+ hash the ops of a block, nested bodies by address as they are already shared
+
+ @param block compiled block
+ @return hash
+*/
+size_t hash_block(const brainfuck_block & block);
+
+/**
+ whether two blocks have the same ops, nested bodies compare by address as they are already shared
+
+ @param a compiled block
+ @param b compiled block
+ @return whether they are interchangeable
+*/
+bool same_block(const brainfuck_block & a, const brainfuck_block & b);
+
+/**
+ compile brainfuck source into a tree of brainfuck_block,
+ loops with identical bodies share a single compiled body
+
+ @param source brainfuck source
+ @param len    length of source
+ @return the program, or std::nullopt if the brackets are not balanced
+*/
+std::optional<brainfuck_block> compile_bf(const char * source, size_t len);
+
+#pragma mark - tape extent analysis
+
+/// cells a block can reach, relative to the cell it starts on
+struct tape_extent {
+    /// false if a loop may drift the pointer arbitrarily far
+    bool bounded = true;
+    /// lowest and highest reachable cell
+    int min = 0;
+    int max = 0;
+    /// net pointer movement after running the block once
+    int shift = 0;
+};
+
+/**
+ bound the pointer range of a block, loops must leave the pointer where they found it
+ (balanced loops) for the range to be known
+
+ @param block the compiled block
+ @return tape_extent
+*/
+tape_extent analyse_extent(const brainfuck_block & block);
+
+/**
+ give the vm the smallest tape that can run a program, the growable
+ infinite tape is kept if the pointer range cannot be bounded statically
+
+ @param status  the brainfuck vm status
+ @param program compiled program
+ @return whether a bounded tape was allocated
+*/
+bool size_tape_for(brainfuck_vm_status & status, const brainfuck_block & program);
+
+/**
+ size_tape_for with an extent found beforehand
+
+ @param status the brainfuck vm status
+ @param extent the extent of a program
+ @return whether a bounded tape was allocated
+*/
+bool size_tape_for(brainfuck_vm_status & status, const tape_extent & extent);
+
+#pragma mark - compiled programs
+
+/// a compiled program with what static analysis found out about it, never modified once built:
+/// running it only reads it, and loop bodies are reached through plain pointers, so any number
+/// of vms on any thread or core can run one program at the same time for a single compile
+///
+/// the shared_ptr owning it must stay on one core, its count is not atomic on the RP2040
+struct brainfuck_program {
+    /// the top-level block
+    brainfuck_block code;
+    /// analyse_extent of code, done once for every vm that sizes its tape for the program
+    tape_extent extent;
+};
+
+/**
+ compile brainfuck source into a brainfuck_program
+
+ @param source brainfuck source
+ @param len    length of source
+ @return the program, or nullptr if the brackets are not balanced
+*/
+std::shared_ptr<const brainfuck_program> compile_program(const char * source, size_t len);
+
+/**
+ wrap a compiled block into a brainfuck_program
+
+ @param code the top-level block
+ @return the program
+*/
+std::shared_ptr<const brainfuck_program> make_program(brainfuck_block code);
+
+/**
+ size_tape_for with the extent found when the program was compiled
+
+ @param status  the brainfuck vm status
+ @param program compiled program
+ @return whether a bounded tape was allocated
+*/
+bool size_tape_for(brainfuck_vm_status & status, const brainfuck_program & program);
+
+#pragma mark - compiled engine
+
+/// outcome of run_compiled
+enum class run_result {
+    /// the program ran to its end
+    finished,
+    /// not enough fuel for the next basic block, run_compiled picks up from there
+    out_of_fuel,
+    /// a `,` found no input ready, run_compiled picks up from that `,` once the io is ready
+    waiting_for_input
+};
+
+/**
+ load a compiled program into the vm, the tape is left as it is
+
+ @param status  the brainfuck vm status
+ @param program compiled program
+*/
+void load_program(brainfuck_vm_status & status, std::shared_ptr<const brainfuck_block> program);
+
+/**
+ load a shared program into the vm, the tape is left as it is
+
+ @param status  the brainfuck vm status
+ @param program compiled program, kept alive by the vm while loaded
+*/
+void load_program(brainfuck_vm_status & status, const std::shared_ptr<const brainfuck_program> & program);
+
+/**
+ the loop whose body is the innermost frame
+
+ @param status the brainfuck vm status, running a loop body
+ @return loop_ir
+*/
+const loop_ir & innermost_loop(const brainfuck_vm_status & status);
+
+/**
+ instruction index of the start of the innermost frame, the `[` of its loop or 0 for the program,
+ pcs in its ops are relative to it
+
+ @param status the brainfuck vm status, running a compiled program
+ @return instruction index
+*/
+int frame_pc(const brainfuck_vm_status & status);
+
+/**
+ run the loaded compiled program until it ends or runs out of fuel
+
+ fuel is paid per basic block: every op up to the next loop test runs
+ unconditionally, so the whole run_cost is taken before the block starts
+ and a block is never started without enough fuel to finish it
+
+ the run is a resumable state machine: the frames hold where it stopped, so a caller waiting
+ for input can do other work, or run other vms, until the io is ready and then call it again
+
+ @param status the brainfuck vm status
+ @return run_result
+*/
+run_result run_compiled(brainfuck_vm_status & status);
@@ -0,0 +1,158 @@
+#include "brainfuck_pack.h"
+#include <cstring>
+#include <unordered_map>
+
+/// ops in token order
+static const char pack_ops[] = "+-><.,[]";
+
+#pragma mark - packing
+
+/// a run of one op
+struct pack_run {
+    uint8_t op;
+    uint8_t count;
+
+    uint8_t token() const {
+        return uint8_t(op << 4 | (count - 1));
+    }
+};
+
+std::vector<uint8_t> pack_bf(const char * source, size_t len) {
+    // split the ops into runs
+    std::vector<pack_run> runs;
+    uint32_t ops = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char * op = source[i] ? strchr(pack_ops, source[i]) : nullptr;
+        if (!op) {
+            continue;
+        }
+        ops++;
+        uint8_t index = uint8_t(op - pack_ops);
+        if (!runs.empty() && runs.back().op == index && runs.back().count < BRAINFUCK_PACK_MAX_RUN) {
+            runs.back().count++;
+        } else {
+            runs.push_back({index, 1});
+        }
+    }
+
+    std::vector<uint8_t> packed(BRAINFUCK_PACK_MAGIC, BRAINFUCK_PACK_MAGIC + 3);
+    packed.push_back(BRAINFUCK_PACK_VERSION);
+    for (int shift = 0; shift < 32; shift += 8) {
+        packed.push_back(uint8_t(ops >> shift));
+    }
+
+    // byte offset of every run emitted as a run token, SIZE_MAX if it went into a match
+    std::vector<size_t> emitted(runs.size(), SIZE_MAX);
+    // runs by their first two tokens, candidates for matches
+    std::unordered_map<uint16_t, std::vector<size_t>> chains;
+    auto key = [&runs](size_t i) { return uint16_t(runs[i].token() << 8 | runs[i + 1].token()); };
+
+    size_t i = 0;
+    while (i < runs.size()) {
+        size_t best_len = 0;
+        size_t best_from = 0;
+        if (i + 1 < runs.size()) {
+            auto chain = chains.find(key(i));
+            if (chain != chains.end()) {
+                // newest candidates first
+                size_t tried = 0;
+                for (auto from = chain->second.rbegin();
+                     from != chain->second.rend() && tried < BRAINFUCK_PACK_MAX_CHAIN;
+                     ++from, ++tried) {
+                    size_t match = 0;
+                    while (i + match < runs.size() && match < BRAINFUCK_PACK_MAX_MATCH &&
+                           *from + match < i &&
+                           emitted[*from + match] == emitted[*from] + match &&
+                           runs[*from + match].token() == runs[i + match].token()) {
+                        match++;
+                    }
+                    if (match > best_len) {
+                        best_len = match;
+                        best_from = *from;
+                    }
+                }
+            }
+        }
+
+        if (best_len >= BRAINFUCK_PACK_MIN_MATCH) {
+            size_t offset = emitted[best_from];
+            packed.push_back(uint8_t(0x80 | (best_len - 2)));
+            packed.push_back(uint8_t(offset >> 8));
+            packed.push_back(uint8_t(offset));
+            i += best_len;
+            continue;
+        }
+
+        emitted[i] = packed.size();
+        packed.push_back(runs[i].token());
+        // match offsets must fit in 16 bits, a run further in can never be a candidate,
+        // and leaving it out keeps the older ones in reach of the chain walk above
+        if (i + 1 < runs.size() && emitted[i] <= 0xffff) {
+            chains[key(i)].push_back(i);
+        }
+        i++;
+    }
+    return packed;
+}
+
+#pragma mark - unpacking
+
+bf_unpacker::bf_unpacker(const uint8_t * packed, size_t len) : packed(packed), len(len) {
+    if (len < BRAINFUCK_PACK_HEADER_LEN || memcmp(packed, BRAINFUCK_PACK_MAGIC, 3) != 0 ||
+        packed[3] != BRAINFUCK_PACK_VERSION) {
+        return;
+    }
+    valid = true;
+    for (int i = 0; i < 4; i++) {
+        ops |= uint32_t(packed[4 + i]) << (8 * i);
+    }
+}
+
+int bf_unpacker::next() {
+    while (run_left == 0) {
+        uint8_t token;
+        if (match_left) {
+            // matches only point at run tokens
+            if (match_pos >= len || packed[match_pos] & 0x80) {
+                valid = false;
+                return -1;
+            }
+            token = packed[match_pos++];
+            match_left--;
+        } else {
+            if (!valid || pos >= len) {
+                // a truncated program decodes to fewer ops than its header says
+                valid = valid && decoded == ops;
+                return -1;
+            }
+            token = packed[pos++];
+            if (token & 0x80) {
+                if (pos + 2 > len) {
+                    valid = false;
+                    return -1;
+                }
+                match_left = (token & 0x7f) + 2u;
+                match_pos = size_t(packed[pos]) << 8 | packed[pos + 1];
+                pos += 2;
+                continue;
+            }
+        }
+        run_op = pack_ops[token >> 4];
+        run_left = (token & 0x0f) + 1u;
+    }
+    run_left--;
+    decoded++;
+    return run_op;
+}
+
+std::optional<brainfuck_block> compile_packed(const uint8_t * packed, size_t len) {
+    bf_unpacker unpacker(packed, len);
+    bf_compiler compiler;
+    for (int c; (c = unpacker.next()) >= 0;) {
+        compiler.feed(char(c));
+    }
+    if (!unpacker.valid) {
+        return std::nullopt;
+    }
+    return compiler.finish();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "brainfuck_ir.h"
+
+/// packed programs start with "BFZ" and the format version
+#define BRAINFUCK_PACK_MAGIC "BFZ"
+#define BRAINFUCK_PACK_VERSION 1
+/// magic, version and the op count as 32-bit little endian
+#define BRAINFUCK_PACK_HEADER_LEN 8
+
+/// longest run of one op in a single run token
+#define BRAINFUCK_PACK_MAX_RUN 16
+/// fewest and most tokens a match token replays
+#define BRAINFUCK_PACK_MIN_MATCH 4
+#define BRAINFUCK_PACK_MAX_MATCH 129
+/// earlier occurrences the packer tries for each match
+#define BRAINFUCK_PACK_MAX_CHAIN 256
+
+#pragma mark - packed programs
+
+// a packed program is a header followed by tokens, comments are dropped
+//
+//   0ooo cccc          run: op `o` (index into "+-><.,[]") repeated c + 1 times
+//   1lll llll hi lo    match: replay l + 2 run tokens starting at byte offset (hi << 8 | lo)
+//
+// matches only ever point at runs, so the decoder replays them straight from the packed
+// bytes and never needs a window of decoded text in RAM
+
+/**
+ pack brainfuck source
+
+ @param source brainfuck source
+ @param len    length of source
+ @return the packed program
+*/
+std::vector<uint8_t> pack_bf(const char * source, size_t len);
+
+/// streams the ops of a packed program one at a time
+struct bf_unpacker {
+    /**
+     @param packed packed program, must outlive the unpacker
+     @param len    length of packed
+    */
+    bf_unpacker(const uint8_t * packed, size_t len);
+
+    /**
+     next op of the program
+
+     @return the op character, or -1 at the end or on a malformed program
+    */
+    int next();
+
+    /// the header is valid, next() returns -1 right away otherwise
+    bool valid = false;
+    /// number of ops in the program, from the header
+    uint32_t ops = 0;
+
+    const uint8_t * packed;
+    size_t len;
+    /// next token to decode
+    size_t pos = BRAINFUCK_PACK_HEADER_LEN;
+    /// next token of the match being replayed
+    size_t match_pos = 0;
+    /// run tokens of the match still to replay
+    uint32_t match_left = 0;
+    /// op of the current run
+    char run_op = 0;
+    /// ops of the current run still to return
+    uint32_t run_left = 0;
+    /// ops returned so far
+    uint32_t decoded = 0;
+};
+
+/**
+ compile a packed program straight from the stream of its ops, the text is never materialised
+
+ @param packed packed program
+ @param len    length of packed
+ @return the program, or std::nullopt if the brackets are not balanced or it is malformed
+*/
+std::optional<brainfuck_block> compile_packed(const uint8_t * packed, size_t len);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#pragma mark - lock-free queue
+
+/// bounded queue between exactly one producer and one consumer, threads on the host or the two
+/// cores of the RP2040, without locks: each side only ever writes its own index, with plain
+/// loads and stores that the Cortex-M0+ does atomically
+template <typename T, size_t N>
+struct spsc_queue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "the capacity must be a power of two");
+
+    /**
+     add an item if there is room
+
+     @param value the item, left as it is if the queue is full
+     @return whether the item was added
+    */
+    bool try_push(T & value) {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - head_index.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[tail & (N - 1)] = std::move(value);
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     take the oldest item if there is one
+
+     @param value set to the item
+     @return whether there was an item
+    */
+    bool try_pop(T & value) {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        if (head == tail_index.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[head & (N - 1)]);
+        head_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     add an item, waiting while the queue is full
+
+     @param value     the item
+     @param cancelled gives up once this is set
+     @param wait      called between attempts, e.g. std::this_thread::yield
+     @return whether the item was added
+    */
+    template <typename Wait>
+    bool push(T value, const std::atomic<bool> & cancelled, Wait wait) {
+        while (!try_push(value)) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            wait();
+        }
+        return true;
+    }
+
+    /**
+     take the oldest item, waiting while the queue is empty
+
+     @param value     set to the item
+     @param cancelled gives up once this is set
+     @param wait      called between attempts, e.g. std::this_thread::yield
+     @return whether there was an item
+    */
+    template <typename Wait>
+    bool pop(T & value, const std::atomic<bool> & cancelled, Wait wait) {
+        while (!try_pop(value)) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            wait();
+        }
+        return true;
+    }
+
+    std::array<T, N> slots;
+    /// next slot to pop, written by the consumer only
+    alignas(64) std::atomic<size_t> head_index{0};
+    /// next slot to push, written by the producer only
+    alignas(64) std::atomic<size_t> tail_index{0};
+};
@@ -0,0 +1,278 @@
+#include "brainfuck_vm.h"
+#include <algorithm>
+#include "brainfuck_diag.h"
+
+#pragma mark - brainfuck ops
+
+const std::map<char, brainfuck_op> bf_op_map {
+    {'+', increment_value_op{}},
+    {'-', decrement_value_op{}},
+    {'>', increment_ptr_op{}},
+    {'<', decrement_ptr_op{}},
+    {'.', print_op{}},
+    {',', read_op{}},
+    {'[', loop_start_op{}},
+    {']', loop_end_op{}}
+};
+
+#pragma mark - helper function
+
+/**
+ the reference interpreter state of a vm, allocated on first use
+
+ @param status the brainfuck vm status
+ @return reference_state
+*/
+static reference_state & reference_of(brainfuck_vm_status & status) {
+    if (!status.reference) {
+        status.reference = std::make_unique<reference_state>();
+    }
+    return *status.reference;
+}
+
+brainfuck_op next_op(brainfuck_vm_status & status, char char_op, bool via_loop) {
+    // find the brainfuck_op from bf_op_map
+    if (auto op = bf_op_map.find(char_op); op != bf_op_map.end()) {
+        // do not append the char_op if we're retriving the next op inside a loop_op
+        if (!via_loop) {
+            reference_state & ref = reference_of(status);
+            // save char_op to instruction
+            ref.instruction.emplace_back(char_op);
+            // increse the ptr of current instruction
+            ref.instruction_ptr_current++;
+        }
+
+        // return next op
+        return op->second;
+    } else {
+        // invaild char for brainfuck
+        // monostate is returned
+        return std::monostate();
+    }
+}
+
+#pragma mark - tape access
+
+void use_ring_tape(brainfuck_vm_status & status, unsigned len_log2) {
+    status.mode = tape_mode::ring;
+    status.tape = paged_tape();
+    status.bounded = std::vector<char>();
+    status.ring.assign(size_t(1) << len_log2, 0);
+    status.ring_mask = uint32_t(status.ring.size() - 1);
+    status.tape_ptr_mask = static_cast<int>(status.ring_mask);
+    status.tape_ptr &= status.tape_ptr_mask;
+    bind_ring_tape(status);
+}
+
+void use_infinite_tape(brainfuck_vm_status & status) {
+    status.mode = tape_mode::infinite;
+    status.ring = std::vector<char>();
+    status.ring_mask = 0;
+    status.bounded = std::vector<char>();
+    status.tape_ptr_mask = -1;
+}
+
+void use_bounded_tape(brainfuck_vm_status & status, int min, int max) {
+    status.mode = tape_mode::bounded;
+    status.tape = paged_tape();
+    status.ring = std::vector<char>();
+    status.ring_mask = 0;
+    status.bounded.assign(size_t(int64_t(max) - min + 1), 0);
+    status.bounded.shrink_to_fit();
+    status.bounded_base = min;
+    status.tape_ptr_mask = -1;
+}
+
+#if BRAINFUCK_VM_USE_INTERP
+interp_ring_binding interp_ring_bound[2];
+
+void bind_ring_interp(const brainfuck_vm_status & status) {
+    interp_config config = interp_default_config();
+    interp_config_set_shift(&config, 0);
+    interp_config_set_mask(&config, 0, __builtin_ctz(status.ring_mask + 1) - 1);
+    interp_set_config(interp0, 0, &config);
+    interp0->base[0] = reinterpret_cast<uintptr_t>(status.ring.data());
+
+    interp_ring_binding & bound = interp_ring_bound[get_core_num()];
+    bound.base = status.ring.data();
+    bound.mask = status.ring_mask;
+}
+#endif
+
+tape_page * fetch_page(paged_tape & tape, int index) {
+    int page_index = index >> BRAINFUCK_VM_TAPE_PAGE_LOG2;
+    auto & pages = page_index >= 0 ? tape.forward : tape.backward;
+    size_t slot = page_index >= 0 ? size_t(page_index) : size_t(~page_index);
+    if (slot >= pages.size()) {
+        pages.resize(slot + 1);
+    }
+
+    auto & page = pages[slot];
+    if (!page) {
+        // fresh pages are already zeroed
+        page = std::make_unique<tape_page>();
+        page->epoch = tape.epoch;
+    } else if (page->epoch != tape.epoch) {
+        // page is left over from before the last reset
+        page->cells.fill(0);
+        page->epoch = tape.epoch;
+    }
+
+    tape.cached_index = page_index;
+    tape.cached_page = page.get();
+    return page.get();
+}
+
+void clear_paged_tape(paged_tape & tape) {
+    tape.epoch++;
+    tape.cached_page = nullptr;
+}
+
+void reset_vm(brainfuck_vm_status & status) {
+    switch (status.mode) {
+        case tape_mode::ring:
+            // the ring is a flat buffer with no room for epochs, its length is bounded though
+            std::fill(status.ring.begin(), status.ring.end(), 0);
+            break;
+        case tape_mode::bounded:
+            std::fill(status.bounded.begin(), status.bounded.end(), 0);
+            break;
+        default:
+            clear_paged_tape(status.tape);
+            break;
+    }
+    status.tape_ptr = 0;
+    status.reference.reset();
+    status.instruction_executed = 0;
+    status.program.reset();
+    status.frames.clear();
+    status.image = nullptr;
+    status.image_pc = 0;
+    status.fuel = UINT64_MAX;
+}
+
+#pragma mark - brainfuck vm interpreter
+
+void run_vm(brainfuck_vm_status & status, char char_op, bool via_loop) {
+    // get the op from char_op
+    brainfuck_op op = next_op(status, char_op, via_loop);
+    reference_state & ref = reference_of(status);
+    if (ref.jump_loop == 0 && !std::holds_alternative<std::monostate>(op)) {
+        status.instruction_executed++;
+    }
+
+    // parttern matching
+    std::visit(brainfuck_vm {
+        [&](increment_value_op) {
+            // printf("increment_value_op\n");
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                tape_cell(status)++;
+                BRAINFUCK_PROFILE(status, 1, 1);
+            }
+        },
+        [&](decrement_value_op) {
+            // printf("decrement_value_op\n");
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                tape_cell(status)--;
+                BRAINFUCK_PROFILE(status, 1, 1);
+            }
+        },
+        [&](increment_ptr_op) {
+            // printf("increment_ptr_op\n");
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                status.tape_ptr = (status.tape_ptr + 1) & status.tape_ptr_mask;
+            }
+        },
+        [&](decrement_ptr_op) {
+            // printf("decrement_ptr_op\n");
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                status.tape_ptr = (status.tape_ptr - 1) & status.tape_ptr_mask;
+            }
+        },
+        [&](print_op) {
+            // printf("print_op\n");
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                status.io->put(tape_cell(status));
+                // printf("%c - %d\n", tape_cell(status), tape_cell(status));
+                BRAINFUCK_TRACE(status, ref.instruction_ptr_current, '.');
+                BRAINFUCK_PROFILE(status, 1, 0);
+            }
+        },
+        [&](read_op) {
+            // skip actual action if we're skipping loop
+            if (ref.jump_loop == 0) {
+                tape_cell(status) = status.io->get();
+                BRAINFUCK_TRACE(status, ref.instruction_ptr_current, ',');
+                BRAINFUCK_PROFILE(status, 0, 1);
+            }
+        },
+        [&](loop_start_op) {
+            // printf("loop from ins ptr: %d cond[%d]\n", ref.instruction_ptr_current, tape_cell(status));
+            // if and only if 1) `current_cell_value != 0`
+            //                2) and we're not do the skipping
+            // we can record the starting index of the if instruction
+            // besides, if we're in condition 1)
+            // the if statement should be also skipped
+            if (ref.jump_loop == 0) {
+                BRAINFUCK_PROFILE(status, 1, 0);
+            }
+            if (tape_cell(status) != 0 && ref.jump_loop == 0) {
+                // push the starting instruction index of loop
+                ref.instruction_loop_ptr.emplace(ref.instruction_ptr_current);
+            } else {
+                ref.jump_loop++;
+            }
+        },
+        [&](loop_end_op) {
+            // printf("loop end ins ptr: %d cond[%d]\n", ref.instruction_ptr_current, tape_cell(status));
+            // decrease the jump_loop value if we encounter the `]`
+            // and we were previously doing the skip
+            if (ref.jump_loop != 0) {
+                ref.jump_loop--;
+            } else {
+                // if we were not in skipping
+                // then we need to check the loop condition, `current_cell_value != 0`
+                BRAINFUCK_PROFILE(status, 1, 0);
+                if (tape_cell(status) != 0) {
+                    // the instruction range of current loop
+                    // printf("loop [%d, %d]:\n", ref.instruction_loop_ptr.top(), ref.instruction_ptr_current);
+#ifdef DEBUG
+                    // dump all instructions inside the loop
+                    // for (int debug = ref.instruction_loop_ptr.top(); debug <= ref.instruction_ptr_current; debug++) {
+                        // putchar(ref.instruction[debug]);
+                    //}
+                    //putchar('\n');
+#endif
+
+                    // loop the instruction until condition satisfies no more
+                    while (tape_cell(status) != 0) {
+                        BRAINFUCK_TRACE(status, ref.instruction_ptr_current, ']');
+                        BRAINFUCK_PROFILE(status, 1, 0);
+                        // save current instruction pointer
+                        int current = ref.instruction_ptr_current;
+                        // start the loop right after the index of `[`
+                        ref.instruction_ptr_current = ref.instruction_loop_ptr.top() + 1;
+                        // run one op at a time
+                        // until the next op is the corresponding `]`
+                        while (ref.instruction_ptr_current < current) {
+                            run_vm(status, ref.instruction[ref.instruction_ptr_current], true);
+                            ref.instruction_ptr_current++;
+                        }
+                        // restore the current instruction pointer
+                        ref.instruction_ptr_current = current;
+                    }
+                }
+
+                // pop current loop starting index, also when the loop ends on its first pass
+                ref.instruction_loop_ptr.pop();
+            }
+        },
+        [&](std::monostate) {
+        }
+    }, op);
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <map>
+#include <memory>
+#include <stack>
+#include <variant>
+#include <vector>
+#include "brainfuck_io.h"
+
+/// brainfuck virtual machine tape length
+#define BRAINFUCK_VM_TAPE_LEN 30000
+
+/// log2 of the number of cells in a page of the infinity length tape
+#define BRAINFUCK_VM_TAPE_PAGE_LOG2 8
+
+/// log2 of the circular tape length, 2^15 cells covers the classic 30000-cell tape
+#define BRAINFUCK_VM_RING_TAPE_LOG2 15
+
+/// compute ring tape cell addresses with the RP2040 SIO interpolator instead of in software,
+/// set by the firmware build
+#ifndef BRAINFUCK_VM_USE_INTERP
+#define BRAINFUCK_VM_USE_INTERP 0
+#endif
+
+#if BRAINFUCK_VM_USE_INTERP
+#include "hardware/interp.h"
+#include "hardware/sync.h"
+#endif
+
+// https://schneide.blog/2018/01/11/c17-the-two-line-visitor-explained/
+template<class... Ts> struct brainfuck_vm : Ts... { using Ts::operator()...; };
+template<class... Ts> brainfuck_vm(Ts...) -> brainfuck_vm<Ts...>;
+
+#pragma mark - brainfuck ops
+
+struct increment_value_op {}; // +
+struct decrement_value_op {}; // -
+
+struct increment_ptr_op {};   // >
+struct decrement_ptr_op {};   // <
+
+struct print_op {};           // ,
+struct read_op {};            // .
+
+struct loop_start_op {};      // [
+struct loop_end_op {};        // ]
+
+/// brainfuck_op allowed ops in C++17 std::variant
+using brainfuck_op = std::variant<
+    increment_value_op,
+    decrement_value_op,
+    increment_ptr_op,
+    decrement_ptr_op,
+    print_op,
+    read_op,
+    loop_start_op,
+    loop_end_op,
+    std::monostate
+>;
+
+/// a map from char to brainfuck_op
+extern const std::map<char, brainfuck_op> bf_op_map;
+
+#pragma mark - brainfuck vm
+
+/// a page of the virtual infinity length tape
+struct tape_page {
+    /// epoch of the paged_tape these cells were last zeroed in
+    uint32_t epoch = 0;
+    /// cells of the page
+    std::array<char, 1 << BRAINFUCK_VM_TAPE_PAGE_LOG2> cells {};
+};
+
+/// virtual infinity length tape, allocated page by page on first touch
+///
+/// bumping `epoch` logically zeroes the whole tape in O(1),
+/// a page from an older epoch is cleared the next time it is touched
+struct paged_tape {
+    /// pages for cells >= 0, page `p` holds cells [p << LOG2, (p + 1) << LOG2)
+    std::vector<std::unique_ptr<tape_page>> forward;
+    /// pages for cells < 0, page `p` (a negative number) is stored at `~p`
+    std::vector<std::unique_ptr<tape_page>> backward;
+    /// pages whose epoch differs from this one hold stale cells
+    uint32_t epoch = 1;
+
+    /// page number of the last page looked up
+    int cached_index = 0;
+    /// the last page looked up, always of the current epoch
+    tape_page * cached_page = nullptr;
+};
+
+/// storage behind the tape
+enum class tape_mode {
+    /// paged_tape, grows in both directions
+    infinite,
+    /// power of two ring buffer, the pointer wraps around
+    ring,
+    /// flat buffer sized by static analysis of the program
+    bounded
+};
+
+struct brainfuck_block;
+
+/// position inside a compiled block
+struct ir_frame {
+    /// the block being run
+    const brainfuck_block * block;
+    /// next op to run, always the start of a basic block
+    size_t index;
+};
+
+/// program text recorded by the reference interpreter, run_vm replays loops from it
+struct reference_state {
+    /// used for keeping track of all valid brainfuck_op
+    std::vector<char> instruction;
+    /// current brainfuck_op index
+    int instruction_ptr_current = -1;
+    /// keeping track of loops
+    std::stack<int> instruction_loop_ptr;
+
+    /// flag of skipping loop, e.g
+    /// +-[[[------------++++++++++-.>>[>]>>>--<<<<<<--]]]++++
+    ///   ^skipping from, but we need all                ^end of skipping
+    ///      instructions inside.
+    int jump_loop = 0;
+};
+
+/// brainfuck virtual machine status
+///
+/// for a compiled program this is only an execution context, the tape and the registers:
+/// the program itself is shared and never written, so many vms can run one program at once
+struct brainfuck_vm_status {
+    /// which tape is in use
+    tape_mode mode = tape_mode::infinite;
+    /// virtual infinity length tape
+    paged_tape tape;
+    /// current cell of the tape
+    int tape_ptr = 0;
+    /// applied to tape_ptr after every move, -1 leaves it unbounded,
+    /// ring_mask keeps it inside a circular tape without a branch
+    int tape_ptr_mask = -1;
+
+    /// fixed size ring buffer tape, its size is always a power of two
+    std::vector<char> ring;
+    /// ring.size() - 1
+    uint32_t ring_mask = 0;
+
+    /// exactly sized tape, holds cells [bounded_base, bounded_base + bounded.size())
+    std::vector<char> bounded;
+    /// index of the first cell of `bounded`
+    int bounded_base = 0;
+
+    /// where `.` and `,` go
+    brainfuck_io * io = &default_io();
+
+    /// state of the reference interpreter, allocated by the first run_vm
+    std::unique_ptr<reference_state> reference;
+
+    /// number of brainfuck_op actually executed (skipped ops are not counted),
+    /// or compiled ops and loop tests when running a compiled program
+    uint64_t instruction_executed = 0;
+
+    /// compiled program loaded by load_program
+    std::shared_ptr<const brainfuck_block> program;
+    /// blocks being run by run_compiled, the loaded program first and the innermost loop body last,
+    /// empty once the program finished
+    std::vector<ir_frame> frames;
+    /// bytecode image loaded by load_image, run in place by run_image, null once it finished
+    const uint32_t * image = nullptr;
+    /// word of the image run_image continues from
+    uint32_t image_pc = 0;
+    /// compiled ops run_compiled or run_image may still execute
+    uint64_t fuel = UINT64_MAX;
+};
+
+#pragma mark - helper function
+
+/**
+ next brainfuck op
+
+ @param status   the brainfuck vm status
+ @param char_op  character form op
+ @param via_loop due to the way I wrote, a flag is needed to avoid re-adding ops
+ @return brainfuck_op
+*/
+brainfuck_op next_op(brainfuck_vm_status & status, char char_op, bool via_loop = false);
+
+#pragma mark - tape access
+
+/**
+ switch the vm to a ring buffer tape, cell indices wrap around modulo its length
+
+ @param status   the brainfuck vm status
+ @param len_log2 log2 of the tape length, 1 to 31
+*/
+void use_ring_tape(brainfuck_vm_status & status, unsigned len_log2);
+
+/**
+ switch the vm back to the virtual infinity length tape
+
+ @param status the brainfuck vm status
+*/
+void use_infinite_tape(brainfuck_vm_status & status);
+
+/**
+ switch the vm to a flat tape holding exactly the cells [min, max],
+ the program must never move the pointer outside of it
+
+ @param status the brainfuck vm status
+ @param min    lowest cell index
+ @param max    highest cell index
+*/
+void use_bounded_tape(brainfuck_vm_status & status, int min, int max);
+
+#if BRAINFUCK_VM_USE_INTERP
+/// ring tape each core's interp0 lane 0 is currently set up for
+struct interp_ring_binding {
+    const char * base = nullptr;
+    uint32_t mask = 0;
+};
+/// indexed by core number
+extern interp_ring_binding interp_ring_bound[2];
+
+/**
+ load the ring tape into interp0 lane 0 of the calling core,
+ afterwards peek[0] yields `base + (accum[0] & mask)`
+
+ @param status the brainfuck vm status
+*/
+void bind_ring_interp(const brainfuck_vm_status & status);
+#endif
+
+/**
+ set interp0 of the calling core up for the ring tape of a vm, unless it already is,
+ so ring_cell never checks; nothing to do for other tapes or without the interpolator
+
+ use_ring_tape, loading a program or image and every compiled or image run call it;
+ run_vm takes one character at a time and leaves it to its caller, once before the source
+
+ @param status the brainfuck vm status
+*/
+inline void bind_ring_tape(const brainfuck_vm_status & status) {
+#if BRAINFUCK_VM_USE_INTERP
+    if (status.mode != tape_mode::ring) {
+        return;
+    }
+    const interp_ring_binding & bound = interp_ring_bound[get_core_num()];
+    if (bound.base != status.ring.data() || bound.mask != status.ring_mask) {
+        bind_ring_interp(status);
+    }
+#else
+    (void)status;
+#endif
+}
+
+/**
+ address of a ring tape cell, the index wraps around the ring
+
+ @param status the brainfuck vm status, must have a ring tape, bound by bind_ring_tape
+               on this core when the interpolator is used
+ @param index  cell index, any value
+ @return pointer to the cell
+*/
+inline char * ring_cell(brainfuck_vm_status & status, int index) {
+#if BRAINFUCK_VM_USE_INTERP
+    (void)status;
+    // the interpolator does the masking and the base addition in one go
+    interp0->accum[0] = static_cast<uint32_t>(index);
+    return reinterpret_cast<char *>(interp0->peek[0]);
+#else
+    return &status.ring[static_cast<uint32_t>(index) & status.ring_mask];
+#endif
+}
+
+/**
+ page of the infinity length tape holding the given cell, slow path of paged_cell
+
+ @param tape  the paged tape
+ @param index cell index
+ @return the page, allocated or cleared if needed
+*/
+tape_page * fetch_page(paged_tape & tape, int index);
+
+/**
+ a cell of the infinity length tape
+
+ @param tape  the paged tape
+ @param index cell index
+ @return reference to the cell
+*/
+inline char & paged_cell(paged_tape & tape, int index) {
+    tape_page * page = tape.cached_page;
+    if (page == nullptr || tape.cached_index != (index >> BRAINFUCK_VM_TAPE_PAGE_LOG2)) {
+        page = fetch_page(tape, index);
+    }
+    return page->cells[index & ((1 << BRAINFUCK_VM_TAPE_PAGE_LOG2) - 1)];
+}
+
+/**
+ zero every cell of the infinity length tape in O(1), pages are kept for reuse
+
+ @param tape the paged tape
+*/
+void clear_paged_tape(paged_tape & tape);
+
+/**
+ the cell under the tape pointer
+
+ @param status the brainfuck vm status
+ @return reference to the cell
+*/
+inline char & tape_cell(brainfuck_vm_status & status) {
+    switch (status.mode) {
+        case tape_mode::ring:
+            return *ring_cell(status, status.tape_ptr);
+        case tape_mode::bounded:
+            return status.bounded[status.tape_ptr - status.bounded_base];
+        default:
+            return paged_cell(status.tape, status.tape_ptr);
+    }
+}
+
+/**
+ bring the vm back to its initial state, keeping the tape mode and every allocation
+
+ @param status the brainfuck vm status
+*/
+void reset_vm(brainfuck_vm_status & status);
+
+#pragma mark - brainfuck vm interpreter
+
+/**
+ run brainfuck vm
+
+ @param status   run brainfuck vm from the given state, a ring tape bound by bind_ring_tape
+                 on the calling core
+ @param char_op  character form op
+ @param via_loop due to the way I wrote, a flag is needed to avoid re-adding ops
+*/
+void run_vm(brainfuck_vm_status & status, char char_op, bool via_loop = false);